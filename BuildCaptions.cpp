@@ -2,6 +2,7 @@
 #include <algorithm>
 
 #include "BuildCaptions.h"
+#include "Profiler.h"
 
 namespace {
 
@@ -268,7 +269,7 @@ bool addLine(std::vector<TextWord *> &words, BOXA *graphicBoxes,
   }
 
   // Do not allow lines that would cross graphical lines / boxes
-  for (int i = 0; i < graphicBoxes->n; ++i) {
+  for (int i = 0; graphicBoxes != NULL and i < graphicBoxes->n; ++i) {
     BOX *gb = graphicBoxes->box[i];
     int w = std::min(gb->x + gb->w, (int)(startX2 + 0.5)) -
             std::max(gb->x, (int)(startX + 0.5));
@@ -335,14 +336,26 @@ Caption buildCaption(CaptionStart start, DocumentStatistics &docStats,
 std::vector<Caption> buildCaptions(std::vector<CaptionStart> &starts,
                                    DocumentStatistics &docStats, TextPage *text,
                                    PIX *graphics, int verbose) {
+  BoxaPtr graphicBoxes;
+  {
+    PROFILE_SCOPE("graphic components");
+    graphicBoxes.reset(pixConnCompBB(graphics, 8));
+  }
+  return buildCaptionsFromBoxes(starts, docStats, text, graphicBoxes.get(),
+                                verbose);
+}
+
+std::vector<Caption>
+buildCaptionsFromBoxes(std::vector<CaptionStart> &starts,
+                       DocumentStatistics &docStats, TextPage *text,
+                       BOXA *graphicBoxes, int verbose) {
+  PROFILE_SCOPE("build captions");
   std::vector<Caption> captions = std::vector<Caption>();
   std::vector<TextWord *> words = collectWords(text);
   std::vector<EdgeLocation> paragraphEdges = getParagraphEdges(words, starts);
-  BOXA *graphicBoxes = pixConnCompBB(graphics, 8);
   for (size_t i = 0; i < starts.size(); ++i) {
     captions.push_back(buildCaption(starts.at(i), docStats, words,
                                     paragraphEdges, graphicBoxes, verbose));
   }
-  boxaDestroy(&graphicBoxes);
   return captions;
 }
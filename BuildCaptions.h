@@ -13,4 +13,13 @@ std::vector<Caption> buildCaptions(std::vector<CaptionStart> &starts,
                                    DocumentStatistics &docStats, TextPage *text,
                                    PIX *graphics, int verbose);
 
+/**
+   As above but checks for conflicts with the given bounding boxes of graphical
+   elements, or skips those checks if graphicBoxes is NULL.
+ */
+std::vector<Caption>
+buildCaptionsFromBoxes(std::vector<CaptionStart> &starts,
+                       DocumentStatistics &docStats, TextPage *text,
+                       BOXA *graphicBoxes, int verbose);
+
 #endif /* defined(__figureextactor__BuildCaptions__) */
@@ -1,7 +1,8 @@
+#include <algorithm>
 #include <unordered_map>
-#include <regex>
 
 #include "ExtractCaptions.h"
+#include "Profiler.h"
 
 namespace {
 
@@ -42,36 +43,21 @@ CaptionCandidate constructCandidate(TextWord *word, int page, bool lineStart,
   if (word->getNext() == NULL)
     return CaptionCandidate();
 
-  const std::regex wordRegex =
-      std::regex("^(Figure|(FIG)|(Fig\\.)||Fig|Table)$");
-  std::match_results<const char *> wordMatch;
-  if (not std::regex_match(word->getText()->getCString(), wordMatch, wordRegex))
+  const char *text = word->getText()->getCString();
+  bool caps, abbreviated;
+  if (not matchCaptionWord(text, &caps, &abbreviated))
     return CaptionCandidate();
 
-  const std::regex numberRegex = std::regex("^([0-9]+)(:|\\.)?$");
-
-  std::match_results<const char *> numberMatch;
-  std::regex_match(word->getNext()->getText()->getCString(), numberMatch,
-                   numberRegex);
-
-  int number;
-  std::string captionNumStr;
-  if (not numberMatch.empty()) {
-    captionNumStr = numberMatch[0].str();
-    number = std::stoi(numberMatch[1].str());
-  } else {
+  const char *numberText = word->getNext()->getText()->getCString();
+  int numberLength;
+  if (not matchCaptionNumber(numberText, &numberLength))
     return CaptionCandidate();
-  }
-  bool periodMatch = false, colonMatch = false;
-  if (captionNumStr.at(captionNumStr.length() - 1) == ':') {
-    colonMatch = true;
-  } else if (captionNumStr.at(captionNumStr.length() - 1) == '.') {
-    periodMatch = true;
-  }
-  FigureType type = wordMatch[0].str().at(0) == 'T' ? TABLE : FIGURE;
+  int number = std::stoi(std::string(numberText, numberLength));
+  bool colonMatch = numberText[numberLength] == ':';
+  bool periodMatch = numberText[numberLength] == '.';
+  FigureType type = text[0] == 'T' ? TABLE : FIGURE;
   return CaptionCandidate(word, lineStart, blockStart, type, number, page,
-                          periodMatch, colonMatch, wordMatch[2].length() > 0,
-                          wordMatch[3].length() > 0);
+                          periodMatch, colonMatch, caps, abbreviated);
 }
 
 // Maps ids -> all candidates that have that id
@@ -82,6 +68,8 @@ typedef std::unordered_map<FigureId,
 CandidateCollection collectCandidates(const std::vector<TextPage *> &pages) {
   CandidateCollection collection = CandidateCollection();
   for (size_t i = 0; i < pages.size(); ++i) {
+    if (pages.at(i) == NULL)
+      continue;
     TextFlow *flow = pages.at(i)->getFlows();
     while (flow != NULL) {
       TextBlock *block = flow->getBlocks();
@@ -168,14 +156,26 @@ public:
 
 class BoldOnly : public CandidateFilter {
 public:
-  BoldOnly() : CandidateFilter("Bold Only", true) {}
-  bool check(const CaptionCandidate &cc) { return wordIsBold(cc.word); }
+  BoldOnly(DocumentStatistics &docStats)
+      : CandidateFilter("Bold Only", true), docStats(docStats) {}
+  bool check(const CaptionCandidate &cc) {
+    return docStats.wordIsBold(cc.word);
+  }
+
+private:
+  DocumentStatistics &docStats;
 };
 
 class ItalicOnly : public CandidateFilter {
 public:
-  ItalicOnly() : CandidateFilter("Italic Only", true) {}
-  bool check(const CaptionCandidate &cc) { return wordIsItalic(cc.word); }
+  ItalicOnly(DocumentStatistics &docStats)
+      : CandidateFilter("Italic Only", true), docStats(docStats) {}
+  bool check(const CaptionCandidate &cc) {
+    return docStats.wordIsItalic(cc.word);
+  }
+
+private:
+  DocumentStatistics &docStats;
 };
 
 class NextWordOnly : public CandidateFilter {
@@ -225,6 +225,19 @@ bool applyFilter(CandidateFilter *filter, CandidateCollection &collection) {
   return true;
 }
 
+// Gets the words of a page in the order collectCandidates visits them
+std::vector<TextWord *> getWordsInOrder(TextPage *page) {
+  std::vector<TextWord *> words = std::vector<TextWord *>();
+  for (TextLine *line : getLines(page)) {
+    TextWord *word = line->getWords();
+    while (word != NULL) {
+      words.push_back(word);
+      word = word->getNext();
+    }
+  }
+  return words;
+}
+
 bool anyDuplicates(const CandidateCollection &collection) {
   for (auto &ccs : collection) {
     if (ccs.second.get()->size() > 1) {
@@ -238,13 +251,14 @@ bool anyDuplicates(const CandidateCollection &collection) {
 
 std::map<int, std::vector<CaptionStart>>
 extractCaptionsFromText(const std::vector<TextPage *> &textPages,
-                        bool verbose) {
+                        DocumentStatistics &docStats, bool verbose) {
+  PROFILE_SCOPE("captions");
   CandidateCollection candidates = collectCandidates(textPages);
   // In order to be considered
   ColonOnly f1 = ColonOnly();
   PeriodOnly f2 = PeriodOnly();
-  BoldOnly f3 = BoldOnly();
-  ItalicOnly f4 = ItalicOnly();
+  BoldOnly f3 = BoldOnly(docStats);
+  ItalicOnly f4 = ItalicOnly(docStats);
   AllCapsFiguresOnly f5 = AllCapsFiguresOnly();
   AbbrevFiguresOnly f6 = AbbrevFiguresOnly();
   NoNextWord f7 = NoNextWord();
@@ -343,3 +357,50 @@ extractCaptionsFromText(const std::vector<TextPage *> &textPages,
     printf("Done parsing captions.\n\n");
   return output;
 }
+
+void writeCaptionStarts(
+    const std::map<int, std::vector<CaptionStart>> &captionStarts,
+    const std::vector<TextPage *> &textPages, std::ostream &output) {
+  size_t total = 0;
+  for (auto &cs : captionStarts) {
+    total += cs.second.size();
+  }
+  output << total << "\n";
+  for (auto &cs : captionStarts) {
+    std::vector<TextWord *> words = getWordsInOrder(textPages.at(cs.first));
+    for (const CaptionStart &start : cs.second) {
+      size_t wordIndex =
+          std::find(words.begin(), words.end(), start.word) - words.begin();
+      output << start.page << " " << start.number << " " << start.type << " "
+             << wordIndex << "\n";
+    }
+  }
+}
+
+bool readCaptionStarts(
+    std::istream &input, const std::vector<TextPage *> &textPages,
+    std::map<int, std::vector<CaptionStart>> &captionStarts) {
+  size_t total;
+  if (not(input >> total))
+    return false;
+  std::vector<TextWord *> words = std::vector<TextWord *>();
+  int wordsPage = -1;
+  for (size_t i = 0; i < total; ++i) {
+    int page, number, type;
+    size_t wordIndex;
+    if (not(input >> page >> number >> type >> wordIndex) or page < 0 or
+        page >= (int)textPages.size() or (type != FIGURE and type != TABLE))
+      return false;
+    if (textPages.at(page) == NULL)
+      continue;
+    if (page != wordsPage) {
+      words = getWordsInOrder(textPages.at(page));
+      wordsPage = page;
+    }
+    if (wordIndex >= words.size())
+      return false;
+    captionStarts[page].push_back(
+        CaptionStart(page, number, words.at(wordIndex), (FigureType)type));
+  }
+  return true;
+}
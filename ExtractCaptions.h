@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <iostream>
 
 #include <TextOutputDev.h>
 
@@ -14,9 +15,28 @@
  * captions will be of the same number and type, but numbers for each type might
  * not be consecutive if some captions could not be located. All returned
  *captions
- * are expected be valid.
+ * are expected be valid. Pages that are NULL in textPages are skipped.
  **/
 std::map<int, std::vector<CaptionStart>>
-extractCaptionsFromText(const std::vector<TextPage *> &textPages, bool verbose);
+extractCaptionsFromText(const std::vector<TextPage *> &textPages,
+                        DocumentStatistics &docStats, bool verbose);
+
+/*
+ * Saves caption starts so they can be re-used by another process, words are
+ * recorded by their position within the text of their page.
+ **/
+void writeCaptionStarts(
+    const std::map<int, std::vector<CaptionStart>> &captionStarts,
+    const std::vector<TextPage *> &textPages, std::ostream &output);
+
+/*
+ * Loads caption starts saved by writeCaptionStarts. Captions on pages whose
+ * entry in textPages is NULL are skipped, so only the text of the pages that
+ * will be processed needs to be extracted. Returns false if the input is
+ * malformed or does not match the given text.
+ **/
+bool readCaptionStarts(std::istream &input,
+                       const std::vector<TextPage *> &textPages,
+                       std::map<int, std::vector<CaptionStart>> &captionStarts);
 
 #endif /* defined(__figureextractor__ExtractCaptions__) */
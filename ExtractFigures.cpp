@@ -1,18 +1,27 @@
 #include "TextUtils.h"
 #include "ExtractFigures.h"
+#include "Geometry.h"
+#include "Profiler.h"
 
 namespace {
 
-int splitBoxVertical(PIX *original, BOX *region) {
-  BOX centerSplit = BOX{region->x, region->y + region->h / 2 - 3, region->w, 5};
+// Copies rect into a BOX on the stack, for leptonica calls that only read the
+// box. Unlike boxCreate this keeps empty or negative sizes as they are.
+BOX toStackBox(const Rect &rect) {
+  return BOX{rect.x, rect.y, rect.w, rect.h};
+}
+
+int splitBoxVertical(PIX *original, const Rect &region) {
+  Rect centerSplit = Rect(region.x, region.y + region.h / 2 - 3, region.w, 5);
   int empty = 0;
-  std::unique_ptr<PIX> rectangle;
-  std::unique_ptr<BOX> split;
-  for (int i = 0; i < (region->h * 1) / 4; i++) {
+  PixPtr rectangle;
+  Rect split;
+  for (int i = 0; i < (region.h * 1) / 4; i++) {
     for (int d = -1; d < 2; d += 2) {
-      split.reset(boxCopy(&centerSplit));
-      split->y += i * d;
-      rectangle.reset(pixClipRectangle(original, split.get(), NULL));
+      split = centerSplit;
+      split.y += i * d;
+      BOX box = toStackBox(split);
+      rectangle.reset(pixClipRectangle(original, &box, NULL));
       pixZero(rectangle.get(), &empty);
       if (empty == 1)
         break;
@@ -22,7 +31,7 @@ int splitBoxVertical(PIX *original, BOX *region) {
   }
 
   if (empty == 1) {
-    int center = split->y + split->h / 2;
+    int center = split.y + split.h / 2;
     return center;
   } else {
     return -1;
@@ -32,18 +41,18 @@ int splitBoxVertical(PIX *original, BOX *region) {
 /*
  Detect if a box2 is below, above, left, or right of box1
  */
-void boxAlignment(BOX *box1, Box *box2, l_int32 tolerance, l_int32 *horizontal,
-                  l_int32 *vertical) {
-  if (box1->x + box1->w + tolerance <= box2->x) {
+void boxAlignment(const Rect &box1, const Rect &box2, l_int32 tolerance,
+                  l_int32 *horizontal, l_int32 *vertical) {
+  if (box1.x + box1.w + tolerance <= box2.x) {
     *horizontal = -1;
-  } else if (box1->x >= box2->x + box2->w + tolerance) {
+  } else if (box1.x >= box2.x + box2.w + tolerance) {
     *horizontal = 1;
   } else {
     *horizontal = 0;
   }
-  if (box1->y + box1->h + tolerance <= box2->y) {
+  if (box1.y + box1.h + tolerance <= box2.y) {
     *vertical = -1;
-  } else if (box1->y >= box2->y + box2->h + tolerance) {
+  } else if (box1.y >= box2.y + box2.h + tolerance) {
     *vertical = 1;
   } else {
     *vertical = 0;
@@ -55,65 +64,68 @@ void boxAlignment(BOX *box1, Box *box2, l_int32 tolerance, l_int32 *horizontal,
  any box in boxes it is not already overlapping. Assumes at least one
  box in boxes is horizontally aligned with box.
  */
-void boxExpandLR(BOX *box, BOXA *boxes) {
+void boxExpandLR(Rect &box, const RectSet &boxes) {
   int l = 99999, r = 99999;
-  for (int j = 0; j < boxes->n; j++) {
+  for (int j = 0; j < boxes.size(); j++) {
     int horizontal = 0, vertical = 0;
-    BOX *box2 = boxes->box[j];
+    Rect box2 = boxes.get(j);
     boxAlignment(box, box2, 0, &horizontal, &vertical);
     if (vertical == 0) {
       if (horizontal == 1) {
-        l = std::min(l, box->x - box2->x - box2->w);
+        l = std::min(l, box.x - box2.x - box2.w);
       } else if (horizontal == -1) {
-        r = std::min(r, box2->x - box->x - box->w);
+        r = std::min(r, box2.x - box.x - box.w);
       }
     }
   }
-  box->w += l + r - 2;
-  box->x -= l - 1;
+  box.w += l + r - 2;
+  box.x -= l - 1;
 }
 
 // As boxExpandLR
-void boxExpandUD(BOX *box, BOXA *boxes) {
+void boxExpandUD(Rect &box, const RectSet &boxes) {
   int u = 99999, d = 99999;
-  for (int j = 0; j < boxes->n; j++) {
+  for (int j = 0; j < boxes.size(); j++) {
     int horizontal = 0, vertical = 0;
-    BOX *box2 = boxes->box[j];
+    Rect box2 = boxes.get(j);
     boxAlignment(box2, box, 0, &horizontal, &vertical);
     if (horizontal == 0) {
       if (vertical == -1) {
-        u = std::min(u, box->y - box2->y - box2->h);
+        u = std::min(u, box.y - box2.y - box2.h);
       } else if (vertical == 1) {
-        d = std::min(d, box2->y - box->y - box->h);
+        d = std::min(d, box2.y - box.y - box.h);
       }
     }
   }
-  box->h += u + d - 2;
-  box->y -= u - 1;
+  box.h += u + d - 2;
+  box.y -= u - 1;
 }
 
-double scoreBox(BOX *region, FigureType type, BOXA *bodyText,
-                BOXA *graphicsBoxes, BOXA *claimedImages, PIX *original) {
-  if (region->w < 25 or region->h < 25) {
+// Scores region, which is claimedImages' box number self or -1 if it is not
+// one of them
+double scoreBox(const Rect &region, int self, FigureType type,
+                const RectSet &bodyText, const RectSet &graphicsBoxes,
+                const RectSet &claimedImages, PIX *original) {
+  if (region.w < 25 or region.h < 25) {
     return 0;
   }
   int zero;
-  pixZero(pixClipRectangle(original, region, NULL), &zero);
+  BOX regionBox = toStackBox(region);
+  PixPtr clipped(pixClipRectangle(original, &regionBox, NULL));
+  pixZero(clipped.get(), &zero);
   if (zero) {
     return 0;
   }
-  BOXA *b = boxaIntersectsBox(bodyText, region);
-  l_int32 intersect = b->n;
-  if (intersect > 0) {
+  if (bodyText.anyIntersects(region)) {
     return 0;
   }
-  for (int i = 0; i < claimedImages->n; i++) {
+  std::vector<float> claimed;
+  claimedImages.getOverlapFractions(region, claimed);
+  for (int i = 0; i < claimedImages.size(); i++) {
     // TODO remove this hack
-    if (claimedImages->box[i] == region)
+    if (i == self)
       continue;
-    float psame;
-    boxOverlapFraction(region, claimedImages->box[i], &psame);
-    if (psame > 0.1) {
+    if (claimed[i] > 0.1) {
       return false;
     }
   }
@@ -122,17 +134,18 @@ double scoreBox(BOX *region, FigureType type, BOXA *bodyText,
 
   int largest = 0;
   bool lineAcross = false;
-  b = boxaIntersectsBox(graphicsBoxes, region);
-  for (int i = 0; i < b->n; i++) {
-    float psame;
-    boxOverlapFraction(region, b->box[i], &psame);
+  std::vector<int> b;
+  graphicsBoxes.getIntersecting(region, b);
+  for (int i : b) {
+    Rect graphic = graphicsBoxes.get(i);
+    float psame = region.overlapFraction(graphic);
     if (psame > 0.98) {
-      largest = std::max(largest, (b->box[i]->w) * (b->box[i]->h));
-      if (b->box[i]->w / ((double)region->w) > 0.50) {
+      largest = std::max(largest, graphic.w * graphic.h);
+      if (graphic.w / ((double)region.w) > 0.50) {
         lineAcross = true;
       }
-    } else if (((b->box[i]->w * b->box[i]->h) > 1000 and psame < 0.50) or
-               ((b->box[i]->w * b->box[i]->h) > 3000 and psame < 0.80)) {
+    } else if ((graphic.w * graphic.h > 1000 and psame < 0.50) or
+               (graphic.w * graphic.h > 3000 and psame < 0.80)) {
       return 0;
     }
   }
@@ -142,14 +155,14 @@ double scoreBox(BOX *region, FigureType type, BOXA *bodyText,
   if (type == FIGURE) {
     if (largest > 18000) {
       score += 2;
-    } else if (largest > 600 or b->n > 2) {
+    } else if (largest > 600 or b.size() > 2) {
       score += 1;
     }
   } else if (lineAcross and largest > 1000) {
     score += 1;
   }
   return score +
-         (region->w * region->h) / ((double)(original->w * original->h));
+         (region.w * region.h) / ((double)(original->w * original->h));
 }
 
 } // End namespace
@@ -158,40 +171,44 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
                                    DocumentStatistics &docStats, bool verbose,
                                    bool showSteps,
                                    std::vector<Figure> &errors) {
+  PROFILE_SCOPE("figures");
+  // Intermediate results, released on return
+  LeptArena arena;
   BOXA *bodytext = pageRegions.bodytext;
   BOXA *graphics = pageRegions.graphics;
-  BOXA *captions = pageRegions.getCaptionsBoxa();
+  BOXA *captions = arena.add(pageRegions.getCaptionsBoxa());
   std::vector<Caption> unassigned_captions = pageRegions.captions;
   int total_captions = captions->n;
 
-  PIXA *steps = showSteps ? pixaCreate(4) : NULL;
+  PIXA *steps = showSteps ? arena.add(pixaCreate(4)) : NULL;
 
   // Add bodyText boxes to fill up the margin
   BOX *margin;
   BOX *foreground;
   pixClipToForeground(original, NULL, &foreground);
+  arena.add(foreground);
   BOX *extent;
   boxaGetExtent(graphics, NULL, NULL, &extent);
-  margin = boxBoundingRegion(extent, foreground);
+  margin = arena.add(boxBoundingRegion(extent, foreground));
   boxDestroy(&extent);
   boxaGetExtent(bodytext, NULL, NULL, &extent);
-  margin = boxBoundingRegion(margin, extent);
+  margin = arena.add(boxBoundingRegion(margin, extent));
   boxDestroy(&extent);
   boxaGetExtent(pageRegions.other, NULL, NULL, &extent);
-  margin = boxBoundingRegion(margin, extent);
+  margin = arena.add(boxBoundingRegion(margin, extent));
+  boxDestroy(&extent);
   int x = margin->x - 2, y = margin->y - 2, h = margin->h + 4,
       w = margin->w + 4;
   x = std::max(x, 0);
   y = std::max(y, 0);
   h = std::min((int)original->h, h);
   w = std::min((int)original->w, w);
-  boxDestroy(&margin);
-  boxaAddBox(bodytext, boxCreate(0, 0, original->w, y), L_CLONE);
+  boxaAddBox(bodytext, boxCreate(0, 0, original->w, y), L_INSERT);
   boxaAddBox(bodytext, boxCreate(0, y + h, original->w, original->h - y - h),
-             L_CLONE);
-  boxaAddBox(bodytext, boxCreate(0, 0, x, original->h), L_CLONE);
+             L_INSERT);
+  boxaAddBox(bodytext, boxCreate(0, 0, x, original->h), L_INSERT);
   boxaAddBox(bodytext, boxCreate(x + w, 0, original->w - x - w, original->h),
-             L_CLONE);
+             L_INSERT);
 
   // Add captions to body text
   boxaJoin(bodytext, captions, 0, captions->n);
@@ -199,16 +216,22 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
   if (showSteps)
     pixaAddPix(steps, original, L_CLONE);
 
+  // Every proposal is compared against these, so they are copied once into
+  // contiguous arrays
+  RectSet bodyRects = RectSet(bodytext);
+  RectSet graphicRects = RectSet(graphics);
+  RectSet captionRects = RectSet(captions);
+
   // Generate proposed regions for each caption box
   double center = original->w / 2.0;
-  BOXAA *allProposals = boxaaCreate(captions->n);
-  BOXA *claimedImages = boxaCreate(captions->n);
-  for (int i = 0; i < captions->n; i++) {
-    BOX *captBox = boxaGetBox(captions, i, L_CLONE);
-    BOXA *proposals = boxaCreate(4);
-    for (int j = 0; j < bodytext->n; j++) {
-      BOX *txtBox = boxaGetBox(bodytext, j, L_CLONE);
-      BOX *proposal = NULL;
+  std::vector<RectSet> allProposals = std::vector<RectSet>();
+  RectSet claimedImages = RectSet();
+  for (int i = 0; i < captionRects.size(); i++) {
+    Rect captBox = captionRects.get(i);
+    RectSet proposals = RectSet();
+    for (int j = 0; j < bodyRects.size(); j++) {
+      Rect txtBox = bodyRects.get(j);
+      Rect proposal;
       int tolerance = 2;
       int horizontal = 0;
       int vertical = 0;
@@ -220,58 +243,61 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
 
       if (vertical == 0) {
         if (horizontal == 1) {
-          proposal = boxRelocateOneSide(NULL, captBox,
-                                        txtBox->x + txtBox->w + 2, L_FROM_LEFT);
-        } else if (horizontal == -1) {
           proposal =
-              boxRelocateOneSide(NULL, captBox, txtBox->x - 2, L_FROM_RIGHT);
+              captBox.relocateOneSide(txtBox.x + txtBox.w + 2, L_FROM_LEFT);
+        } else if (horizontal == -1) {
+          proposal = captBox.relocateOneSide(txtBox.x - 2, L_FROM_RIGHT);
         }
-        boxExpandUD(proposal, bodytext);
+        boxExpandUD(proposal, bodyRects);
         if (horizontal == -1) {
-          proposal->w -= captBox->w + 1;
-          proposal->x = captBox->x + captBox->w + 1;
+          proposal.w -= captBox.w + 1;
+          proposal.x = captBox.x + captBox.w + 1;
         } else if (horizontal == 1) {
-          proposal->w -= captBox->w + 1;
+          proposal.w -= captBox.w + 1;
         }
       } else {
         if (vertical == 1) {
-          proposal = boxRelocateOneSide(NULL, captBox,
-                                        txtBox->y + txtBox->h + 3, L_FROM_TOP);
-        } else if (vertical == -1) {
           proposal =
-              boxRelocateOneSide(NULL, captBox, txtBox->y - 3, L_FROM_BOT);
+              captBox.relocateOneSide(txtBox.y + txtBox.h + 3, L_FROM_TOP);
+        } else if (vertical == -1) {
+          proposal = captBox.relocateOneSide(txtBox.y - 3, L_FROM_BOT);
         }
-        boxExpandLR(proposal, bodytext);
+        boxExpandLR(proposal, bodyRects);
         if (vertical == -1) {
-          proposal->h -= captBox->h + 1;
-          proposal->y = captBox->y + captBox->h + 1;
+          proposal.h -= captBox.h + 1;
+          proposal.y = captBox.y + captBox.h + 1;
         } else if (vertical == 1) {
-          proposal->h -= captBox->h + 1;
+          proposal.h -= captBox.h + 1;
         }
       }
 
       // For two columns document, captions that do not
       // cross the center should not have regions pass the center
       if (docStats.documentIsTwoColumn()) {
-        if (captBox->x + captBox->w <= center and
-            proposal->x + proposal->w > center) {
-          boxRelocateOneSide(proposal, proposal, center - 1, L_FROM_RIGHT);
-        } else if (captBox->x >= center and proposal->x < center) {
-          boxRelocateOneSide(proposal, proposal, center + 1, L_FROM_LEFT);
+        if (captBox.x + captBox.w <= center and
+            proposal.x + proposal.w > center) {
+          proposal = proposal.relocateOneSide(center - 1, L_FROM_RIGHT);
+        } else if (captBox.x >= center and proposal.x < center) {
+          proposal = proposal.relocateOneSide(center + 1, L_FROM_LEFT);
         }
       }
 
-      BOX *clippedProposal;
-      pixClipBoxToForeground(original, proposal, NULL, &clippedProposal);
-      if (clippedProposal != NULL and
-          scoreBox(clippedProposal, pageRegions.captions.at(i).type, bodytext,
-                   graphics, claimedImages, original) > 0) {
-        boxaAddBox(proposals, clippedProposal, L_CLONE);
+      BOX proposalBox = toStackBox(proposal);
+      BOX *clipped;
+      pixClipBoxToForeground(original, &proposalBox, NULL, &clipped);
+      if (clipped == NULL)
+        continue;
+      Rect clippedProposal = Rect(clipped);
+      boxDestroy(&clipped);
+      if (scoreBox(clippedProposal, -1, pageRegions.captions.at(i).type,
+                   bodyRects, graphicRects, claimedImages, original) > 0) {
+        proposals.add(clippedProposal);
       }
     }
 
-    if (proposals->n > 0) {
-      boxaaAddBoxa(allProposals, proposals, L_CLONE);
+    PROFILE_COUNT("proposals", proposals.size());
+    if (proposals.size() > 0) {
+      allProposals.push_back(proposals);
     } else {
       // Give up on this caption
       int on_caption = i - (total_captions - unassigned_captions.size());
@@ -287,14 +313,15 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
   // Now go through every possible assignment of captions
   // to proposals pick the highest scorign one
   int numConfigurations = 1;
-  for (int i = 0; i < allProposals->n; ++i) {
-    numConfigurations *= allProposals->boxa[i]->n;
+  for (const RectSet &proposals : allProposals) {
+    numConfigurations *= proposals.size();
   }
 
+  PROFILE_COUNT("configurations", numConfigurations);
   if (verbose)
     printf("Found %d possible configurations\n", numConfigurations);
 
-  BOXA *bestProposals = NULL;
+  RectSet bestProposals = RectSet();
   std::vector<bool> bestKeep;
   int bestFound = -1;
   double bestScore = -1;
@@ -302,28 +329,25 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
 
     // Gather the proposed regions based on the configuration number
     int configNum = onConfig;
-    BOXA *proposals = boxaCreate(allProposals->n);
+    RectSet proposals = RectSet();
     std::vector<bool> keep;
-    for (int i = 0; i < allProposals->n; ++i) {
-      int numProposals = allProposals->boxa[i]->n;
+    for (const RectSet &options : allProposals) {
+      int numProposals = options.size();
       int selected = configNum % numProposals;
       configNum = configNum / numProposals;
-      boxaAddBox(proposals, allProposals->boxa[i]->box[selected], L_COPY);
+      proposals.add(options.get(selected));
     }
 
     // Attempt to split any overlapping regions
-    for (int i = 0; i < proposals->n; ++i) {
-      for (int j = i; j < proposals->n; ++j) {
-        BOX *p1 = proposals->box[i];
-        BOX *p2 = proposals->box[j];
-        int eq;
-        boxEqual(p1, p2, &eq);
-        if (not eq)
+    for (int i = 0; i < proposals.size(); ++i) {
+      for (int j = i; j < proposals.size(); ++j) {
+        Rect p1 = proposals.get(i);
+        if (not(p1 == proposals.get(j)))
           continue;
         int vertical, horizontal;
-        boxAlignment(unassigned_captions.at(i).boundingBox,
-                     unassigned_captions.at(j).boundingBox, 2, &horizontal,
-                     &vertical);
+        boxAlignment(Rect(unassigned_captions.at(i).boundingBox),
+                     Rect(unassigned_captions.at(j).boundingBox), 2,
+                     &horizontal, &vertical);
         if (vertical == 0 or horizontal != 0)
           continue;
 
@@ -331,16 +355,25 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
         if (split > 0) {
           BOX *topClipped;
           BOX *botClipped;
-          BOX *top = boxRelocateOneSide(NULL, p1, split - 1, L_FROM_BOT);
-          pixClipBoxToForeground(original, top, NULL, &topClipped);
-          BOX *bot = boxRelocateOneSide(NULL, p1, split + 1, L_FROM_TOP);
-          pixClipBoxToForeground(original, bot, NULL, &botClipped);
+          BOX top = toStackBox(p1.relocateOneSide(split - 1, L_FROM_BOT));
+          pixClipBoxToForeground(original, &top, NULL, &topClipped);
+          BOX bot = toStackBox(p1.relocateOneSide(split + 1, L_FROM_TOP));
+          pixClipBoxToForeground(original, &bot, NULL, &botClipped);
+          if (topClipped == NULL or botClipped == NULL) {
+            boxDestroy(&topClipped);
+            boxDestroy(&botClipped);
+            continue;
+          }
+          Rect topRect = Rect(topClipped);
+          Rect botRect = Rect(botClipped);
+          boxDestroy(&topClipped);
+          boxDestroy(&botClipped);
           if (vertical == -1) {
-            proposals->box[i] = topClipped;
-            proposals->box[j] = botClipped;
+            proposals.set(i, topRect);
+            proposals.set(j, botRect);
           } else {
-            proposals->box[i] = botClipped;
-            proposals->box[j] = topClipped;
+            proposals.set(i, botRect);
+            proposals.set(j, topRect);
           }
           if (verbose)
             printf("Split a region vertically\n");
@@ -349,17 +382,18 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
     }
 
     if (showSteps) {
-      pixaAddPix(steps, pixDrawBoxa(original, proposals, 4, 0xff000000),
-                 L_CLONE);
+      BoxaPtr drawn(proposals.toBoxa());
+      pixaAddPix(steps, pixDrawBoxa(original, drawn.get(), 4, 0xff000000),
+                 L_INSERT);
     }
 
     // Score the proposals
     int numFound = 0;
     double totalScore = 0;
-    for (int i = 0; i < proposals->n; ++i) {
+    for (int i = 0; i < proposals.size(); ++i) {
       double score =
-          scoreBox(proposals->box[i], pageRegions.captions.at(i).type, bodytext,
-                   graphics, proposals, original);
+          scoreBox(proposals.get(i), i, pageRegions.captions.at(i).type,
+                   bodyRects, graphicRects, proposals, original);
       totalScore += score;
       if (score > 0) {
         numFound += 1;
@@ -374,35 +408,37 @@ std::vector<Figure> extractFigures(PIX *original, PageRegions &pageRegions,
         (numFound == bestFound and totalScore > bestScore)) {
       bestFound = numFound;
       bestScore = totalScore;
-      bestProposals = proposals;
+      bestProposals = std::move(proposals);
       bestKeep = keep;
     }
   }
 
   if (showSteps) {
     BOX *clip;
-    PIXA *show = pixaCreate(4);
+    PIXA *show = arena.add(pixaCreate(4));
     pixClipBoxToForeground(original, NULL, NULL, &clip);
+    arena.add(clip);
     int pad = 10;
     clip->x -= 10;
     clip->y -= 10;
     clip->w += pad * 2;
     clip->h += pad * 2;
     for (int i = 0; i < steps->n; ++i) {
-      pixaAddPix(show, pixClipRectangle(steps->pix[i], clip, NULL), L_CLONE);
+      pixaAddPix(show, pixClipRectangle(steps->pix[i], clip, NULL), L_INSERT);
     }
-    pixDisplay(pixaDisplayTiled(pixaConvertTo32(show), 4000, 1, 30), 0, 0);
+    PIXA *show32 = arena.add(pixaConvertTo32(show));
+    pixDisplay(arena.add(pixaDisplayTiled(show32, 4000, 1, 30)), 0, 0);
   }
 
-  for (int i = 0; i < bestProposals->n; ++i) {
+  for (int i = 0; i < bestProposals.size(); ++i) {
     if (bestKeep.at(i)) {
-      BOX *imageBox = bestProposals->box[i];
+      Rect imageBox = bestProposals.get(i);
       int pad = 2;
-      imageBox->x -= pad;
-      imageBox->y -= pad;
-      imageBox->w += pad * 2;
-      imageBox->h += pad * 2;
-      figures.push_back(Figure(unassigned_captions.at(i), imageBox));
+      imageBox.x -= pad;
+      imageBox.y -= pad;
+      imageBox.w += pad * 2;
+      imageBox.h += pad * 2;
+      figures.push_back(Figure(unassigned_captions.at(i), imageBox.toBox()));
     } else {
       errors.push_back(Figure(unassigned_captions.at(i), NULL));
     }
@@ -1,10 +1,10 @@
+#include <algorithm>
 #include <unordered_map>
-#include <regex>
 
 #include "TextUtils.h"
 #include "ExtractRegions.h"
-
-// TODO minimal memory mangement in this section
+#include "Geometry.h"
+#include "Profiler.h"
 
 // Draw the region into background
 PIX *PageRegions::drawRegions(PIX *background) {
@@ -27,7 +27,7 @@ PIX *PageRegions::drawRegions(PIX *background) {
 // Create a BOXA of the caption boxes
 BOXA *PageRegions::getCaptionsBoxa() {
   BOXA *boxes = boxaCreate((int)captions.size());
-  for (Caption caption : captions) {
+  for (const Caption &caption : captions) {
     boxaAddBox(boxes, caption.boundingBox, L_COPY);
   }
   return boxes;
@@ -35,9 +35,6 @@ BOXA *PageRegions::getCaptionsBoxa() {
 
 namespace {
 
-const std::regex titleNumberRegex =
-    std::regex("^[0-9]{1,2}(\\.[0-9]{1,3})?\\.?$");
-
 // Pulls lines that appear to be titles from lines
 std::vector<TextLine *> getTitleLines(std::vector<TextLine *> &lines, int page,
                                       DocumentStatistics &docStats,
@@ -112,8 +109,7 @@ std::vector<TextLine *> getTitleLines(std::vector<TextLine *> &lines, int page,
     }
 
     TextWord *word = line->getWords();
-    bool isTitleStart =
-        regex_match(word->getText()->getCString(), titleNumberRegex);
+    bool isTitleStart = matchTitleNumber(word->getText()->getCString());
     double x = 0, y = 0, x2 = 0, y2 = 0;
     getTextLineBB(line, &x, &y, &x2, &y2);
 
@@ -183,22 +179,28 @@ std::vector<TextLine *> getTitleLines(std::vector<TextLine *> &lines, int page,
 PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
                            const std::vector<Caption> &captions,
                            DocumentStatistics &docStats, int page, bool verbose,
-                           bool showSteps, std::vector<Figure> &errors) {
+                           bool showSteps, std::vector<Figure> &errors,
+                           LeptArena &pageArena) {
+  PROFILE_SCOPE("regions");
 
+  // Intermediate results, released on return
+  LeptArena arena;
   PIX *scratch;
-  PIXA *steps = showSteps ? steps = pixaCreate(4) : NULL;
+  PIXA *steps = showSteps ? arena.add(pixaCreate(4)) : NULL;
 
   std::vector<TextLine *> lines = getLines(text);
 
-  BOXA *otherText = boxaCreate((int)lines.size());
-  BOXA *bodyText = boxaCreate((int)lines.size());
-  BOXA *graphicBoxes = boxaCreate(0);
+  BOXA *otherText = arena.add(boxaCreate((int)lines.size()));
+  BOXA *bodyText = pageArena.add(boxaCreate((int)lines.size()));
+  BOXA *graphicBoxes = pageArena.add(boxaCreate(0));
 
   // Identify caption boxes
-  BOXA *captionBoxes = boxaCreate((int)captions.size());
-  for (Caption capt : captions) {
+  BOXA *captionBoxes = arena.add(boxaCreate((int)captions.size()));
+  for (const Caption &capt : captions) {
     boxaAddBox(captionBoxes, capt.boundingBox, L_CLONE);
   }
+  // Every word is checked against the captions
+  RectSet captionRects = RectSet(captionBoxes);
 
   const int l_pad = 0;
   const int r_pad = 0;
@@ -210,7 +212,7 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
     double x, y, x2, y2;
     getTextLineBB(title, &x, &y, &x2, &y2);
     boxaAddBox(bodyText, boxCreate(x - 3, y - 3, x2 - x + 6, y2 - y + 6),
-               L_CLONE);
+               L_INSERT);
   }
 
   for (TextLine *line : lines) {
@@ -220,15 +222,11 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
     while (word != NULL) {
       double lineX, lineY, lineX2, lineY2;
       word->getBBox(&lineX, &lineY, &lineX2, &lineY2);
-      BOX *wordBox = boxCreate(lineX + 1, lineY + 1, lineX2 - lineX - 1,
-                               lineY2 - lineY - 1);
-      int contains;
-      for (int i = 0; i < captionBoxes->n; ++i) {
-        boxContains(captionBoxes->box[i], wordBox, &contains);
-        if (contains)
-          break;
-      }
-      if (contains) {
+      // Words without a valid box are never inside a caption
+      Rect wordBox;
+      if (Rect::create(lineX + 1, lineY + 1, lineX2 - lineX - 1,
+                       lineY2 - lineY - 1, wordBox) and
+          captionRects.anyContains(wordBox)) {
         word = word->getNext();
         continue;
       }
@@ -238,14 +236,10 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
       while (word != NULL) {
         double x, y, x2, y2;
         word->getBBox(&x, &y, &x2, &y2);
-        BOX *wordBox = boxCreate(x + 0.5, y + 0.5, x2 - x + 0.5, y2 - y + 0.5);
-        int contains;
-        for (int i = 0; i < captionBoxes->n; ++i) {
-          boxContains(captionBoxes->box[i], wordBox, &contains);
-          if (contains)
-            break;
-        }
-        if (contains) {
+        Rect wordBox;
+        if (Rect::create(x + 0.5, y + 0.5, x2 - x + 0.5, y2 - y + 0.5,
+                         wordBox) and
+            captionRects.anyContains(wordBox)) {
           word = word->getNext();
           continue;
         }
@@ -260,47 +254,48 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
         boxaAddBox(graphicBoxes,
                    boxCreate(lineX + 0.5, lineY + 0.5, lineX2 - lineX + 0.5,
                              lineY2 - lineY + 0.5),
-                   L_CLONE);
+                   L_INSERT);
       } else {
         boxaAddBox(otherText,
                    boxCreate(lineX - l_pad + 0.5, lineY - h_pad + 0.5,
                              lineX2 - lineX + l_pad + 0.5 + r_pad,
                              lineY2 - lineY + 2 * h_pad + 0.5),
-                   L_CLONE);
+                   L_INSERT);
       }
     }
   }
 
-  pix1 = pixCreate(original->w, original->h, 1);
-  PIX *textMask = pixMaskBoxa(NULL, pix1, otherText, L_SET_PIXELS);
-  textMask = pixConvertTo1(textMask, 250);
-  pixDestroy(&pix1);
+  pix1 = arena.add(pixCreate(original->w, original->h, 1));
+  PIX *textMask = arena.add(pixMaskBoxa(NULL, pix1, otherText, L_SET_PIXELS));
+  textMask = arena.add(pixConvertTo1(textMask, 250));
 
   // Helps seperate text seperated by images
   pixSubtract(textMask, textMask, graphics);
   if (steps != NULL) {
     pix1 = pixDrawBoxa(original, otherText, 2, 0);
-    pixaAddPix(steps, pixDrawBoxa(pix1, bodyText, 2, 0x0000ff00), L_CLONE);
+    pixaAddPix(steps, pixDrawBoxa(pix1, bodyText, 2, 0x0000ff00), L_INSERT);
     pixDestroy(&pix1);
   }
 
-  PIXA *ccs = pixaCreate(0);
-  otherText = pixConnComp(textMask, &ccs, 4);
+  PIXA *ccs = NULL;
+  otherText = arena.add(pixConnComp(textMask, &ccs, 4));
+  arena.add(ccs);
 
   if (showSteps) { // Add the original with the boxes outlined
-    scratch = pixPaintBoxa(pixCreateTemplate(original), otherText, 0);
-    pixaAddPix(steps, pixPaintBoxa(scratch, bodyText, 0x0000000), L_CLONE);
+    scratch = pixPaintBoxa(arena.add(pixCreateTemplate(original)), otherText,
+                           0);
+    pixaAddPix(steps, pixPaintBoxa(scratch, bodyText, 0x0000000), L_INSERT);
     pixDestroy(&scratch);
   }
 
   // Get the graphic regions
   if (showSteps)
     pixaAddPix(steps, graphics, L_COPY);
-  BOXA *tmp = pixConnCompBB(graphics, 8);
+  BOXA *tmp = arena.add(pixConnCompBB(graphics, 8));
   boxaJoin(graphicBoxes, tmp, 0, tmp->n);
-  scratch = pixMaskBoxa(NULL, pixCreateTemplate(graphics), graphicBoxes,
-                        L_SET_PIXELS);
-  PIX *graphicMask = pixConvertTo1(scratch, 250);
+  scratch = pixMaskBoxa(NULL, arena.add(pixCreateTemplate(graphics)),
+                        graphicBoxes, L_SET_PIXELS);
+  PIX *graphicMask = arena.add(pixConvertTo1(scratch, 250));
   if (showSteps)
     pixaAddPix(steps, graphicMask, L_COPY);
   pixDestroy(&scratch);
@@ -319,8 +314,7 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
         if (verbose)
           printf("Splitting up a text box due to caption overlap\n");
         BOXA *split_bb = pixSplitComponentIntoBoxa(
-            pixaGetPix(ccs, onBox, L_CLONE), otherText->box[onBox], 10, 2, 15,
-            50, 7, 0);
+            ccs->pix[onBox], otherText->box[onBox], 10, 2, 15, 50, 7, 0);
         // Assume surronding box is bodyText
         boxaJoin(bodyText, split_bb, 0, split_bb->n);
         boxaDestroy(&split_bb);
@@ -332,16 +326,16 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
     }
   }
   if (showSteps and foundSplit) {
-    scratch = pixDrawBoxa(original, otherText, 5, 0);
-    scratch = pixDrawBoxa(scratch, bodyText, 5, 0);
-    pixaAddPix(steps, pixDrawBoxa(scratch, captionBoxes, 5, 0), L_CLONE);
-    pixDestroy(&scratch);
+    scratch = arena.add(pixDrawBoxa(original, otherText, 5, 0));
+    scratch = arena.add(pixDrawBoxa(scratch, bodyText, 5, 0));
+    pixaAddPix(steps, pixDrawBoxa(scratch, captionBoxes, 5, 0), L_INSERT);
   }
 
   // Handle lines over the top
   if (graphicBoxes->n > 0) {
-    graphicBoxes = boxaSort(graphicBoxes, L_SORT_BY_Y, L_SORT_INCREASING, NULL);
-    BOX *box = boxaGetBox(graphicBoxes, 0, L_CLONE);
+    graphicBoxes = pageArena.add(
+        boxaSort(graphicBoxes, L_SORT_BY_Y, L_SORT_INCREASING, NULL));
+    BOX *box = graphicBoxes->box[0];
     if (box->y < 50 and box->h < 5 and box->w / ((double)original->w) > 0.70) {
       boxaAddBox(bodyText, box, L_COPY);
       boxaRemoveBox(graphicBoxes, 0);
@@ -351,7 +345,7 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
   }
 
   // Classify boxes
-  BOXA *other = boxaCreate(0);
+  BOXA *other = pageArena.add(boxaCreate(0));
   for (int i = 0; i < otherText->n; ++i) {
     BOX *curBox = otherText->box[i];
     float graphicOverlap;
@@ -393,19 +387,15 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
   }
 
   // Filter graphic boxes
+  RectSet bodyRects = RectSet(bodyText);
   for (int i = 0; i < graphicBoxes->n; ++i) {
-    BOX *graphicBox = graphicBoxes->box[i];
-    if (graphicBox->w > 50 or graphicBox->h > 50) {
+    Rect graphicBox = Rect(graphicBoxes->box[i]);
+    if (graphicBox.w > 50 or graphicBox.h > 50) {
       continue;
     }
-    for (int j = 0; j < bodyText->n; ++j) {
-      float overlap;
-      boxOverlapFraction(bodyText->box[j], graphicBox, &overlap);
-      if (overlap > 0.80) {
-        boxaRemoveBox(graphicBoxes, i);
-        --i;
-        break;
-      }
+    if (bodyRects.anyCovers(graphicBox, 0.80)) {
+      boxaRemoveBox(graphicBoxes, i);
+      --i;
     }
   }
 
@@ -413,24 +403,26 @@ PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
 
   if (showSteps) { // Add the graphics with the boxes outlined
     pixaInsertPix(steps, 0, pixConvertTo1(original, 250), NULL);
-    pixaAddPix(steps, regions.drawRegions(pixCreateTemplate(original)),
-               L_CLONE);
+    pixaAddPix(steps,
+               regions.drawRegions(arena.add(pixCreateTemplate(original))),
+               L_INSERT);
 
     BOX *clip;
     PIXA *show = pixaCreate(steps->n);
-    pixClipBoxToForeground(pixConvertTo1(original, 250), NULL, NULL, &clip);
+    pixClipBoxToForeground(arena.add(pixConvertTo1(original, 250)), NULL, NULL,
+                           &clip);
     int pad = 10;
     clip->x -= 10;
     clip->y -= 10;
     clip->w += pad * 2;
     clip->h += pad * 2;
     for (int i = 0; i < steps->n; ++i) {
-      pixaAddPix(show, pixClipRectangle(steps->pix[i], clip, NULL), L_CLONE);
+      pixaAddPix(show, pixClipRectangle(steps->pix[i], clip, NULL), L_INSERT);
     }
     boxDestroy(&clip);
-    pixDisplay(pixaDisplayTiled(pixaConvertTo32(show), 3000, 1, 30), 0, 0);
+    PIXA *show32 = arena.add(pixaConvertTo32(show));
+    pixDisplay(arena.add(pixaDisplayTiled(show32, 3000, 1, 30)), 0, 0);
     pixaDestroy(&show);
-    pixaDestroy(&steps);
   }
   return regions;
 }
@@ -9,6 +9,7 @@
 
 #include "PDFUtils.h"
 #include "ExtractCaptions.h"
+#include "LeptHandles.h"
 
 /**
  Module for dividing up an image of a pdf file into
@@ -32,6 +33,7 @@ public:
 
   PIX *drawRegionsBW(PIX *background);
 
+  // The caller owns the returned BOXA
   BOXA *getCaptionsBoxa();
 };
 
@@ -40,11 +42,13 @@ public:
    only the grpahics (graphics) and the locations of the caption starts
    of the page (captionStarts), returns a PageRegions object that breaks the
    PDF page in text, graphic, caption, or other regions. Does not take
-   ownerish of any arguements.
+   ownerish of any arguements. The BOXAs of the returned regions belong to
+   pageArena, so they are valid until it is released.
  */
 PageRegions getPageRegions(PIX *original, TextPage *text, PIX *graphics,
                            const std::vector<Caption> &captionStarts,
                            DocumentStatistics &docStats, int page, bool verbose,
-                           bool showSteps, std::vector<Figure> &errors);
+                           bool showSteps, std::vector<Figure> &errors,
+                           LeptArena &pageArena);
 
 #endif /* defined(__figureextractor__ExtractRegions__) */
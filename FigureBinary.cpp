@@ -0,0 +1,315 @@
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "FigureBinary.h"
+
+namespace {
+
+const char fileMagic[8] = {'P', 'D', 'F', 'F', 'I', 'G', 'B', '\0'};
+const char indexMagic[8] = {'P', 'D', 'F', 'F', 'I', 'G', 'I', '\0'};
+const uint32_t formatVersion = 1;
+const uint32_t byteOrderMark = 0x01020304;
+const uint32_t documentMagic = 0x42444650;
+
+const size_t headerSize = 16;
+const size_t trailerSize = 24;
+const size_t documentHeaderSize = 24;
+const size_t figureHeaderSize = 72;
+const size_t wordSize = 48;
+
+size_t pad8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+template <typename T> void put(std::string &output, T value) {
+  output.append((const char *)&value, sizeof(T));
+}
+
+template <typename T> T get(const char *data) {
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+void padOutput(std::string &output) {
+  output.append(pad8(output.size()) - output.size(), '\0');
+}
+
+void encodeFigure(const FigureRecord &record, std::string &output) {
+  size_t stringsLength = record.caption.size();
+  for (const WordRecord &word : record.imageText)
+    stringsLength += word.text.size();
+  size_t length = figureHeaderSize + wordSize * record.imageText.size() +
+                  pad8(stringsLength);
+
+  put<uint32_t>(output, length);
+  put<uint8_t>(output, record.type == "Table" ? 1 : 0);
+  put<uint8_t>(output,
+               (record.hasCaption ? 1 : 0) | (record.hasImage ? 2 : 0));
+  put<uint16_t>(output, 0);
+  put<int32_t>(output, record.number);
+  put<int32_t>(output, record.page);
+  put<int32_t>(output, record.width);
+  put<int32_t>(output, record.height);
+  put<double>(output, record.dpi);
+  for (int i = 0; i < 4; ++i)
+    put<int32_t>(output, record.captionBB[i]);
+  for (int i = 0; i < 4; ++i)
+    put<int32_t>(output, record.imageBB[i]);
+  put<uint32_t>(output, record.caption.size());
+  put<uint32_t>(output, record.imageText.size());
+
+  uint32_t textOffset = record.caption.size();
+  for (const WordRecord &word : record.imageText) {
+    for (int i = 0; i < 4; ++i)
+      put<double>(output, word.bb[i]);
+    put<int32_t>(output, word.rotation);
+    put<uint32_t>(output, textOffset);
+    put<uint32_t>(output, word.text.size());
+    put<uint32_t>(output, 0);
+    textOffset += word.text.size();
+  }
+  output += record.caption;
+  for (const WordRecord &word : record.imageText)
+    output += word.text;
+  padOutput(output);
+}
+
+std::string encodeDocument(const std::string &name,
+                           const std::vector<FigureRecord> &records) {
+  std::string figures = std::string();
+  for (const FigureRecord &record : records)
+    encodeFigure(record, figures);
+  std::string block = std::string();
+  put<uint32_t>(block, documentMagic);
+  put<uint32_t>(block, records.size());
+  put<uint64_t>(block,
+                documentHeaderSize + pad8(name.size()) + figures.size());
+  put<uint32_t>(block, name.size());
+  put<uint32_t>(block, 0);
+  block += name;
+  padOutput(block);
+  block += figures;
+  return block;
+}
+
+// Returns the length of the document block at offset, or 0 if there is not a
+// valid block there
+uint64_t getBlockLength(const char *data, size_t size, uint64_t offset) {
+  if (offset % 8 != 0 or offset + documentHeaderSize > size or
+      get<uint32_t>(data + offset) != documentMagic)
+    return 0;
+  uint64_t length = get<uint64_t>(data + offset + 8);
+  uint32_t nameLength = get<uint32_t>(data + offset + 16);
+  if (length % 8 != 0 or length > size - offset or
+      documentHeaderSize + pad8(nameLength) > length)
+    return 0;
+  return length;
+}
+
+// Reads the document offsets of a file, falling back to walking the document
+// blocks if the index is missing or damaged. dataEnd is set to the end of the
+// last document block.
+bool readIndex(const char *data, size_t size, std::vector<uint64_t> &offsets,
+               uint64_t *dataEnd) {
+  offsets.clear();
+  if (size < headerSize or memcmp(data, fileMagic, 8) != 0 or
+      get<uint32_t>(data + 8) != formatVersion or
+      get<uint32_t>(data + 12) != byteOrderMark)
+    return false;
+
+  if (size >= headerSize + trailerSize and
+      memcmp(data + size - 8, indexMagic, 8) == 0) {
+    uint64_t indexOffset = get<uint64_t>(data + size - trailerSize);
+    uint64_t nDocuments = get<uint64_t>(data + size - trailerSize + 8);
+    bool valid = indexOffset >= headerSize and
+                 indexOffset <= size - trailerSize and
+                 nDocuments == (size - trailerSize - indexOffset) / 8 and
+                 (size - trailerSize - indexOffset) % 8 == 0;
+    for (uint64_t i = 0; valid and i < nDocuments; ++i) {
+      uint64_t offset = get<uint64_t>(data + indexOffset + 8 * i);
+      valid = offset < indexOffset and getBlockLength(data, size, offset) != 0;
+      offsets.push_back(offset);
+    }
+    if (valid) {
+      *dataEnd = indexOffset;
+      return true;
+    }
+    offsets.clear();
+  }
+
+  uint64_t offset = headerSize;
+  uint64_t length;
+  while ((length = getBlockLength(data, size, offset)) != 0) {
+    offsets.push_back(offset);
+    offset += length;
+  }
+  *dataEnd = offset;
+  return true;
+}
+
+bool writeAll(int fd, const std::string &data, off_t offset) {
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = pwrite(fd, data.data() + written, data.size() - written,
+                       offset + written);
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  return true;
+}
+
+bool appendLocked(int fd, const std::string &documentName,
+                  const std::vector<FigureRecord> &records) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  size_t size = st.st_size;
+  std::vector<uint64_t> offsets = std::vector<uint64_t>();
+  uint64_t dataEnd = headerSize;
+  if (size < headerSize) {
+    // New file, or one whose creator died before writing the header
+    std::string header = std::string(fileMagic, 8);
+    put<uint32_t>(header, formatVersion);
+    put<uint32_t>(header, byteOrderMark);
+    if (not writeAll(fd, header, 0))
+      return false;
+  } else {
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      return false;
+    bool ok = readIndex((const char *)map, size, offsets, &dataEnd);
+    munmap(map, size);
+    if (not ok)
+      return false;
+  }
+
+  // The new block replaces the old index, then the index is written again
+  std::string block = encodeDocument(documentName, records);
+  offsets.push_back(dataEnd);
+  std::string index = std::string();
+  for (uint64_t offset : offsets)
+    put<uint64_t>(index, offset);
+  put<uint64_t>(index, dataEnd + block.size());
+  put<uint64_t>(index, offsets.size());
+  index.append(indexMagic, 8);
+  return writeAll(fd, block, dataEnd) and
+         writeAll(fd, index, dataEnd + block.size()) and
+         ftruncate(fd, dataEnd + block.size() + index.size()) == 0;
+}
+
+} // end namespace
+
+bool appendFigureBinary(const std::string &path,
+                        const std::string &documentName,
+                        const std::vector<FigureRecord> &records) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+    return false;
+  if (flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return false;
+  }
+  bool ok = appendLocked(fd, documentName, records);
+  flock(fd, LOCK_UN);
+  close(fd);
+  return ok;
+}
+
+FigureBinaryReader::FigureBinaryReader(const std::string &path)
+    : data(NULL), size(0), ok(false), offsets(std::vector<uint64_t>()) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  // Blocks are never changed once written, so only the index needs to be
+  // read under the lock
+  struct stat st;
+  if (flock(fd, LOCK_SH) == 0 and fstat(fd, &st) == 0 and st.st_size > 0) {
+    size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      data = (const char *)map;
+      uint64_t dataEnd;
+      ok = readIndex(data, size, offsets, &dataEnd);
+    }
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+}
+
+FigureBinaryReader::~FigureBinaryReader() {
+  if (data != NULL)
+    munmap((void *)data, size);
+}
+
+bool FigureBinaryReader::isOk() { return ok; }
+
+int FigureBinaryReader::getNumDocuments() { return offsets.size(); }
+
+std::string FigureBinaryReader::getDocumentName(int document) {
+  const char *block = data + offsets.at(document);
+  return std::string(block + documentHeaderSize,
+                     get<uint32_t>(block + 16));
+}
+
+int FigureBinaryReader::getNumFigures(int document) {
+  return get<uint32_t>(data + offsets.at(document) + 4);
+}
+
+bool FigureBinaryReader::readFigures(int document,
+                                     std::vector<FigureRecord> &records) {
+  uint64_t offset = offsets.at(document);
+  const char *block = data + offset;
+  uint64_t blockLength = get<uint64_t>(block + 8);
+  uint32_t nFigures = get<uint32_t>(block + 4);
+  uint64_t position = documentHeaderSize + pad8(get<uint32_t>(block + 16));
+  for (uint32_t i = 0; i < nFigures; ++i) {
+    if (position + figureHeaderSize > blockLength)
+      return false;
+    const char *figure = block + position;
+    uint32_t length = get<uint32_t>(figure);
+    uint32_t captionLength = get<uint32_t>(figure + 64);
+    uint32_t nWords = get<uint32_t>(figure + 68);
+    uint64_t stringsStart = figureHeaderSize + (uint64_t)wordSize * nWords;
+    if (length % 8 != 0 or length > blockLength - position or
+        stringsStart + captionLength > length)
+      return false;
+    const char *strings = figure + stringsStart;
+    uint64_t stringsLength = length - stringsStart;
+
+    FigureRecord record = FigureRecord();
+    record.type = figure[4] == 1 ? "Table" : "Figure";
+    record.hasCaption = (figure[5] & 1) != 0;
+    record.hasImage = (figure[5] & 2) != 0;
+    record.number = get<int32_t>(figure + 8);
+    record.page = get<int32_t>(figure + 12);
+    record.width = get<int32_t>(figure + 16);
+    record.height = get<int32_t>(figure + 20);
+    record.dpi = get<double>(figure + 24);
+    for (int j = 0; j < 4; ++j) {
+      record.captionBB[j] = get<int32_t>(figure + 32 + 4 * j);
+      record.imageBB[j] = get<int32_t>(figure + 48 + 4 * j);
+    }
+    record.caption = std::string(strings, captionLength);
+    for (uint32_t j = 0; j < nWords; ++j) {
+      const char *entry = figure + figureHeaderSize + wordSize * j;
+      WordRecord word;
+      for (int k = 0; k < 4; ++k)
+        word.bb[k] = get<double>(entry + 8 * k);
+      word.rotation = get<int32_t>(entry + 32);
+      uint32_t textOffset = get<uint32_t>(entry + 36);
+      uint32_t textLength = get<uint32_t>(entry + 40);
+      if ((uint64_t)textOffset + textLength > stringsLength)
+        return false;
+      word.text = std::string(strings + textOffset, textLength);
+      record.imageText.push_back(word);
+    }
+    records.push_back(record);
+    position += length;
+  }
+  return true;
+}
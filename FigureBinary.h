@@ -0,0 +1,75 @@
+#ifndef __figureextractor__FigureBinary__
+#define __figureextractor__FigureBinary__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "FigureRecord.h"
+
+/**
+  Binary format for FigureRecords that is much cheaper to load than JSON.
+  Many documents can be appended to the same file, and an index at the end of
+  the file gives random access to them. All values use the byte order of the
+  machine that wrote the file, the header records it so readers can reject
+  files from other machines. Everything is 8 byte aligned so the file can be
+  read in place from a memory map.
+
+  File:      header, document blocks, index, trailer
+  Header:    char magic[8] "PDFFIGB", uint32 version, uint32 byte order mark
+  Document:  uint32 magic, uint32 number of figures, uint64 block length,
+             uint32 name length, uint32 0, name (padded), figures
+  Figure:    uint32 record length, uint8 type (0 figure, 1 table), uint8 flags
+             (1 has caption, 2 has image), uint16 0, int32 number, page, width
+             and height, double dpi, int32 captionBB[4], int32 imageBB[4],
+             uint32 caption length, uint32 number of words, words, strings
+             (the caption and then the text of each word, padded)
+  Word:      double bb[4], int32 rotation, uint32 text offset (into the
+             figure's strings), uint32 text length, uint32 0
+  Index:     uint64 offset of each document block
+  Trailer:   uint64 index offset, uint64 number of documents, char magic[8]
+             "PDFFIGI"
+
+  Appending rewrites the index and trailer, document blocks are never
+  modified once written. If a writer dies part way the index is rebuilt by
+  walking the document blocks.
+ */
+
+// Appends the figures of a document to the file at path, creating it if
+// needed. Concurrent appends from several processes are serialized with
+// flock. Returns false if the file could not be written or is not a figure
+// file.
+bool appendFigureBinary(const std::string &path,
+                        const std::string &documentName,
+                        const std::vector<FigureRecord> &records);
+
+class FigureBinaryReader {
+public:
+  // Maps the file at path, check isOk() before using the reader
+  FigureBinaryReader(const std::string &path);
+
+  ~FigureBinaryReader();
+
+  bool isOk();
+
+  int getNumDocuments();
+
+  std::string getDocumentName(int document);
+
+  int getNumFigures(int document);
+
+  // Appends the figures of a document to records, returns false if the
+  // document is malformed
+  bool readFigures(int document, std::vector<FigureRecord> &records);
+
+private:
+  FigureBinaryReader(const FigureBinaryReader &);
+  FigureBinaryReader &operator=(const FigureBinaryReader &);
+
+  const char *data;
+  size_t size;
+  bool ok;
+  std::vector<uint64_t> offsets;
+};
+
+#endif /* defined(__figureextractor__FigureBinary__) */
@@ -0,0 +1,185 @@
+#include <cstdio>
+
+#include "FigureRecord.h"
+
+FigureRecord::FigureRecord()
+    : type(""), number(0), page(0), dpi(0), width(0), height(0),
+      hasCaption(false), captionBB{0, 0, 0, 0}, caption(""), hasImage(false),
+      imageBB{0, 0, 0, 0}, imageText(std::vector<WordRecord>()),
+      images(std::vector<ImageRecord>()) {}
+
+void appendJSONEscaped(const char *text, size_t length, std::string &output) {
+  size_t start = 0;
+  size_t i = 0;
+  while (i < length) {
+    unsigned char c = text[i];
+    if (c > 127) {
+      // For multi-byte encoding, skip over extra trailling bytes
+      for (int bit = 6; bit >= 0 and ((c >> bit) & 1) == 1; --bit)
+        ++i;
+      ++i;
+    } else if (c == '\\' or c == '\"' or c <= 31) {
+      output.append(text + start, i - start);
+      if (c <= 31) {
+        // Replace controls sequence and new lines with spaces
+        output += ' ';
+      } else {
+        output += '\\';
+        output += c;
+      }
+      ++i;
+      start = i;
+    } else {
+      ++i;
+    }
+  }
+  if (start < length)
+    output.append(text + start, length - start);
+}
+
+namespace {
+
+void appendInt(std::string &output, int value) {
+  char buf[16];
+  output.append(buf, snprintf(buf, sizeof(buf), "%d", value));
+}
+
+void appendUInt64(std::string &output, uint64_t value) {
+  char buf[24];
+  output.append(buf, snprintf(buf, sizeof(buf), "%llu",
+                              (unsigned long long)value));
+}
+
+// Matches how std::ostream formats doubles by default
+void appendDouble(std::string &output, double value) {
+  char buf[32];
+  output.append(buf, snprintf(buf, sizeof(buf), "%g", value));
+}
+
+void appendBox(std::string &output, const int *bb) {
+  output += '[';
+  for (int i = 0; i < 4; ++i) {
+    if (i != 0)
+      output += ',';
+    appendInt(output, bb[i]);
+  }
+  output += ']';
+}
+
+} // end namespace
+
+void writeFigureRecordJSON(const FigureRecord &record, bool compact,
+                           std::string &buffer, std::ostream &output) {
+  const char *nl = compact ? "" : "\n";
+  const char *indent = compact ? "" : "\n\t";
+  buffer.clear();
+  buffer += "{\"Type\":\"";
+  buffer += record.type;
+  buffer += "\",";
+  buffer += nl;
+  buffer += "\"Number\": ";
+  appendInt(buffer, record.number);
+  buffer += ",";
+  buffer += nl;
+  buffer += "\"Page\": ";
+  appendInt(buffer, record.page);
+  buffer += ",";
+  buffer += nl;
+  buffer += "\"DPI\": ";
+  appendDouble(buffer, record.dpi);
+  buffer += ",";
+  buffer += nl;
+  buffer += "\"Width\": ";
+  appendInt(buffer, record.width);
+  buffer += ",";
+  buffer += nl;
+  buffer += "\"Height\": ";
+  appendInt(buffer, record.height);
+  buffer += ",";
+  buffer += nl;
+
+  if (not record.hasCaption) {
+    buffer += "\"CaptionBB\": null,";
+    buffer += nl;
+    buffer += "\"Caption\": null,";
+    buffer += nl;
+  } else {
+    buffer += "\"CaptionBB\": ";
+    appendBox(buffer, record.captionBB);
+    buffer += ",";
+    buffer += nl;
+    buffer += "\"Caption\": \"";
+    appendJSONEscaped(record.caption.data(), record.caption.size(), buffer);
+    buffer += "\",";
+    buffer += nl;
+  }
+
+  if (not record.hasImage) {
+    buffer += "\"ImageBB\": null,";
+    buffer += nl;
+    buffer += "\"ImageText\" : null";
+    buffer += nl;
+    buffer += "}";
+    buffer += nl;
+  } else {
+    buffer += "\"ImageBB\": ";
+    appendBox(buffer, record.imageBB);
+    buffer += ",";
+    buffer += nl;
+    buffer += "\"ImageText\" : [";
+    for (size_t i = 0; i < record.imageText.size(); ++i) {
+      const WordRecord &word = record.imageText[i];
+      if (i != 0)
+        buffer += ",";
+      buffer += indent;
+      buffer += "{\"Rotation\": ";
+      appendInt(buffer, word.rotation);
+      buffer += ",\"TextBB\": [";
+      for (int j = 0; j < 4; ++j) {
+        if (j != 0)
+          buffer += ',';
+        appendDouble(buffer, word.bb[j]);
+      }
+      buffer += "], \"Text\": \"";
+      appendJSONEscaped(word.text.data(), word.text.size(), buffer);
+      buffer += "\"}";
+    }
+    buffer += nl;
+    buffer += "]";
+    if (record.images.size() != 0) {
+      buffer += ",";
+      buffer += nl;
+      buffer += "\"Images\": [";
+      for (size_t i = 0; i < record.images.size(); ++i) {
+        const ImageRecord &image = record.images[i];
+        if (i != 0)
+          buffer += ",";
+        buffer += indent;
+        buffer += "{\"Name\": \"";
+        appendJSONEscaped(image.name.data(), image.name.size(), buffer);
+        buffer += "\", \"Offset\": ";
+        appendUInt64(buffer, image.offset);
+        buffer += ", \"Length\": ";
+        appendUInt64(buffer, image.length);
+        buffer += "}";
+      }
+      buffer += nl;
+      buffer += "]";
+    }
+    buffer += "}";
+  }
+  output.write(buffer.data(), buffer.size());
+}
+
+void writeFigureRecordsJSON(const std::vector<FigureRecord> &records,
+                            std::string &buffer, std::ostream &output) {
+  output << "[\n";
+  for (size_t i = 0; i < records.size(); ++i) {
+    writeFigureRecordJSON(records[i], false, buffer, output);
+    if (i != records.size() - 1) {
+      output << ",";
+    }
+    output << "\n";
+  }
+  output << "]\n";
+}
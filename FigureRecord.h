@@ -0,0 +1,67 @@
+#ifndef __figureextractor__FigureRecord__
+#define __figureextractor__FigureRecord__
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdint>
+
+/**
+  Plain descriptions of extracted figures, holding everything that is written
+  out for a figure so output formats do not need poppler or leptonica objects.
+  Bounding boxes are stored as x1, y1, x2, y2.
+ */
+class WordRecord {
+public:
+  int rotation;
+  double bb[4];
+  // UTF-8, not escaped
+  std::string text;
+};
+
+// An image of a figure stored in an archive
+class ImageRecord {
+public:
+  std::string name;
+  uint64_t offset;
+  uint64_t length;
+};
+
+class FigureRecord {
+public:
+  FigureRecord();
+
+  // "Figure" or "Table"
+  std::string type;
+  int number;
+  // Starts from 1
+  int page;
+  double dpi;
+  int width;
+  int height;
+  bool hasCaption;
+  int captionBB[4];
+  std::string caption;
+  bool hasImage;
+  int imageBB[4];
+  std::vector<WordRecord> imageText;
+  // Only set when images are saved to an archive
+  std::vector<ImageRecord> images;
+};
+
+// Appends text to output escaped for use in a JSON string. New lines and
+// control characters are replaced with spaces, multi-byte UTF-8 sequences are
+// copied as is.
+void appendJSONEscaped(const char *text, size_t length, std::string &output);
+
+// Writes record as a JSON object, compact output has no line breaks. buffer is
+// used to build the output and can be re-used between calls to avoid
+// allocations.
+void writeFigureRecordJSON(const FigureRecord &record, bool compact,
+                           std::string &buffer, std::ostream &output);
+
+// Writes records as a JSON array, formatted as pdffigures' -j output
+void writeFigureRecordsJSON(const std::vector<FigureRecord> &records,
+                            std::string &buffer, std::ostream &output);
+
+#endif /* defined(__figureextractor__FigureRecord__) */
@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#include "Geometry.h"
+
+namespace {
+
+// Area of the overlap of two rectangles, 0 if they do not intersect. With
+// inclusive edges the overlap is non-empty exactly when they intersect.
+inline int overlapArea(int x1, int y1, int w1, int h1, int x2, int y2, int w2,
+                       int h2) {
+  int w = std::min(x1 + w1, x2 + w2) - std::max(x1, x2);
+  int h = std::min(y1 + h1, y2 + h2) - std::max(y1, y2);
+  return std::max(w, 0) * std::max(h, 0);
+}
+
+inline bool intersects(int x1, int y1, int w1, int h1, int x2, int y2, int w2,
+                       int h2) {
+  return not(y2 + h2 - 1 < y1 or y1 + h1 - 1 < y2 or x1 + w1 - 1 < x2 or
+             x2 + w2 - 1 < x1);
+}
+
+inline bool contains(int x1, int y1, int w1, int h1, int x2, int y2, int w2,
+                     int h2) {
+  return x1 <= x2 and y1 <= y2 and x1 + w1 >= x2 + w2 and y1 + h1 >= y2 + h2;
+}
+
+// Leptonica divides by the area of an empty box, there is no overlap to
+// report so this returns 0 instead
+inline float fraction(int overlap, int area) {
+  return area == 0 ? 0 : (float)overlap / (float)area;
+}
+
+} // end namespace
+
+Rect::Rect() : x(0), y(0), w(0), h(0) {}
+
+Rect::Rect(int x, int y, int w, int h) : x(x), y(y), w(w), h(h) {}
+
+Rect::Rect(const BOX *box) : x(box->x), y(box->y), w(box->w), h(box->h) {}
+
+bool Rect::create(int x, int y, int w, int h, Rect &rect) {
+  if (w < 0 or h < 0)
+    return false;
+  if (x < 0) {
+    w += x;
+    x = 0;
+    if (w <= 0)
+      return false;
+  }
+  if (y < 0) {
+    h += y;
+    y = 0;
+    if (h <= 0)
+      return false;
+  }
+  rect = Rect(x, y, w, h);
+  return true;
+}
+
+BOX *Rect::toBox() const { return boxCreate(x, y, w, h); }
+
+bool Rect::contains(const Rect &other) const {
+  return ::contains(x, y, w, h, other.x, other.y, other.w, other.h);
+}
+
+bool Rect::intersects(const Rect &other) const {
+  return ::intersects(x, y, w, h, other.x, other.y, other.w, other.h);
+}
+
+float Rect::overlapFraction(const Rect &other) const {
+  return fraction(overlapArea(x, y, w, h, other.x, other.y, other.w, other.h),
+                  other.area());
+}
+
+Rect Rect::relocateOneSide(int loc, int sideFlag) const {
+  // As in boxSetGeometry, a new value of -1 leaves the old one in place
+  Rect moved = *this;
+  if (sideFlag == L_FROM_LEFT) {
+    moved.x = loc == -1 ? x : loc;
+    moved.w = w + x - loc == -1 ? w : w + x - loc;
+  } else if (sideFlag == L_FROM_RIGHT) {
+    moved.w = loc - x + 1 == -1 ? w : loc - x + 1;
+  } else if (sideFlag == L_FROM_TOP) {
+    moved.y = loc == -1 ? y : loc;
+    moved.h = h + y - loc == -1 ? h : h + y - loc;
+  } else if (sideFlag == L_FROM_BOT) {
+    moved.h = loc - y + 1 == -1 ? h : loc - y + 1;
+  }
+  return moved;
+}
+
+bool Rect::operator==(const Rect &other) const {
+  return x == other.x and y == other.y and w == other.w and h == other.h;
+}
+
+RectSet::RectSet()
+    : xs(std::vector<int>()), ys(std::vector<int>()), ws(std::vector<int>()),
+      hs(std::vector<int>()) {}
+
+RectSet::RectSet(const BOXA *boxa) : RectSet() {
+  xs.reserve(boxa->n);
+  ys.reserve(boxa->n);
+  ws.reserve(boxa->n);
+  hs.reserve(boxa->n);
+  for (int i = 0; i < boxa->n; ++i)
+    add(Rect(boxa->box[i]));
+}
+
+void RectSet::set(int i, const Rect &rect) {
+  xs[i] = rect.x;
+  ys[i] = rect.y;
+  ws[i] = rect.w;
+  hs[i] = rect.h;
+}
+
+void RectSet::add(const Rect &rect) {
+  xs.push_back(rect.x);
+  ys.push_back(rect.y);
+  ws.push_back(rect.w);
+  hs.push_back(rect.h);
+}
+
+BOXA *RectSet::toBoxa() const {
+  BOXA *boxa = boxaCreate(size());
+  for (int i = 0; i < size(); ++i)
+    boxaAddBox(boxa, get(i).toBox(), L_INSERT);
+  return boxa;
+}
+
+// The queries below count matches instead of stopping at the first one, so
+// the loops have no early exit and can be vectorized
+
+bool RectSet::anyContains(const Rect &rect) const {
+  int found = 0;
+  for (int i = 0; i < size(); ++i)
+    found += ::contains(xs[i], ys[i], ws[i], hs[i], rect.x, rect.y, rect.w,
+                        rect.h);
+  return found != 0;
+}
+
+bool RectSet::anyIntersects(const Rect &rect) const {
+  int found = 0;
+  for (int i = 0; i < size(); ++i)
+    found += ::intersects(xs[i], ys[i], ws[i], hs[i], rect.x, rect.y, rect.w,
+                          rect.h);
+  return found != 0;
+}
+
+bool RectSet::anyCovers(const Rect &rect, float fraction) const {
+  int area = rect.area();
+  int found = 0;
+  for (int i = 0; i < size(); ++i) {
+    int overlap = overlapArea(xs[i], ys[i], ws[i], hs[i], rect.x, rect.y,
+                              rect.w, rect.h);
+    found += ::fraction(overlap, area) > fraction;
+  }
+  return found != 0;
+}
+
+void RectSet::getIntersecting(const Rect &rect,
+                              std::vector<int> &indices) const {
+  indices.clear();
+  for (int i = 0; i < size(); ++i) {
+    if (::intersects(xs[i], ys[i], ws[i], hs[i], rect.x, rect.y, rect.w,
+                     rect.h))
+      indices.push_back(i);
+  }
+}
+
+void RectSet::getOverlapFractions(const Rect &rect,
+                                  std::vector<float> &fractions) const {
+  fractions.resize(size());
+  for (int i = 0; i < size(); ++i) {
+    int overlap = overlapArea(rect.x, rect.y, rect.w, rect.h, xs[i], ys[i],
+                              ws[i], hs[i]);
+    fractions[i] = ::fraction(overlap, ws[i] * hs[i]);
+  }
+}
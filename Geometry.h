@@ -0,0 +1,103 @@
+#ifndef __figureextractor__Geometry__
+#define __figureextractor__Geometry__
+
+#include <vector>
+
+#include <leptonica/allheaders.h>
+
+/**
+  Value type rectangles for the heuristics that compare many boxes against
+  each other, so they do not allocate a leptonica BOX per comparison.
+  Everything matches leptonica's conventions: rectangles are x, y, w, h with
+  inclusive edges (x + w - 1 is the last column inside), and the predicates
+  give the same answers as the leptonica functions they are named after.
+ */
+class Rect {
+public:
+  Rect();
+
+  Rect(int x, int y, int w, int h);
+
+  explicit Rect(const BOX *box);
+
+  // As boxCreate: clips off the part left of or above the origin, and
+  // returns false where boxCreate would return NULL, for a negative width or
+  // height or when nothing is left after clipping
+  static bool create(int x, int y, int w, int h, Rect &rect);
+
+  // The caller owns the returned BOX
+  BOX *toBox() const;
+
+  int area() const { return w * h; }
+
+  // As boxContains, true if other is inside this rectangle
+  bool contains(const Rect &other) const;
+
+  // As boxIntersects
+  bool intersects(const Rect &other) const;
+
+  // As boxOverlapFraction(this, other), the area of the overlap divided by
+  // the area of other
+  float overlapFraction(const Rect &other) const;
+
+  // As boxRelocateOneSide, moves the side given by sideFlag (L_FROM_LEFT,
+  // L_FROM_RIGHT, L_FROM_TOP or L_FROM_BOT) to loc
+  Rect relocateOneSide(int loc, int sideFlag) const;
+
+  bool operator==(const Rect &other) const;
+
+  int x;
+  int y;
+  int w;
+  int h;
+};
+
+/**
+  A list of rectangles stored as one array per coordinate, so the batch
+  queries below are simple loops over contiguous ints the compiler can
+  vectorize.
+ */
+class RectSet {
+public:
+  RectSet();
+
+  // Copies the boxes of boxa
+  explicit RectSet(const BOXA *boxa);
+
+  int size() const { return xs.size(); }
+
+  Rect get(int i) const { return Rect(xs[i], ys[i], ws[i], hs[i]); }
+
+  void set(int i, const Rect &rect);
+
+  void add(const Rect &rect);
+
+  // The caller owns the returned BOXA
+  BOXA *toBoxa() const;
+
+  // True if any rectangle in the set contains rect
+  bool anyContains(const Rect &rect) const;
+
+  // True if any rectangle in the set intersects rect
+  bool anyIntersects(const Rect &rect) const;
+
+  // True if any rectangle in the set covers more than fraction of rect's area,
+  // as boxOverlapFraction(rectangle, rect) > fraction
+  bool anyCovers(const Rect &rect, float fraction) const;
+
+  // Sets indices to the rectangles that intersect rect, as boxaIntersectsBox
+  void getIntersecting(const Rect &rect, std::vector<int> &indices) const;
+
+  // Sets fractions[i] to boxOverlapFraction(rect, rectangle i), the part of
+  // rectangle i that rect covers
+  void getOverlapFractions(const Rect &rect,
+                           std::vector<float> &fractions) const;
+
+private:
+  std::vector<int> xs;
+  std::vector<int> ys;
+  std::vector<int> ws;
+  std::vector<int> hs;
+};
+
+#endif /* defined(__figureextractor__Geometry__) */
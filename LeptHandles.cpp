@@ -0,0 +1,56 @@
+#include "LeptHandles.h"
+
+LeptArena::LeptArena()
+    : pixs(std::vector<PIX *>()), pixas(std::vector<PIXA *>()),
+      boxes(std::vector<BOX *>()), boxas(std::vector<BOXA *>()),
+      boxaas(std::vector<BOXAA *>()) {}
+
+LeptArena::~LeptArena() { release(); }
+
+PIX *LeptArena::add(PIX *pix) {
+  if (pix != NULL)
+    pixs.push_back(pix);
+  return pix;
+}
+
+PIXA *LeptArena::add(PIXA *pixa) {
+  if (pixa != NULL)
+    pixas.push_back(pixa);
+  return pixa;
+}
+
+BOX *LeptArena::add(BOX *box) {
+  if (box != NULL)
+    boxes.push_back(box);
+  return box;
+}
+
+BOXA *LeptArena::add(BOXA *boxa) {
+  if (boxa != NULL)
+    boxas.push_back(boxa);
+  return boxa;
+}
+
+BOXAA *LeptArena::add(BOXAA *boxaa) {
+  if (boxaa != NULL)
+    boxaas.push_back(boxaa);
+  return boxaa;
+}
+
+void LeptArena::release() {
+  for (BOXAA *boxaa : boxaas)
+    boxaaDestroy(&boxaa);
+  for (BOXA *boxa : boxas)
+    boxaDestroy(&boxa);
+  for (BOX *box : boxes)
+    boxDestroy(&box);
+  for (PIXA *pixa : pixas)
+    pixaDestroy(&pixa);
+  for (PIX *pix : pixs)
+    pixDestroy(&pix);
+  boxaas.clear();
+  boxas.clear();
+  boxes.clear();
+  pixas.clear();
+  pixs.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef __figureextractor__LeptHandles__
+#define __figureextractor__LeptHandles__
+
+#include <memory>
+#include <vector>
+
+#include <leptonica/allheaders.h>
+
+/**
+  Ownership helpers for leptonica objects. Leptonica objects are reference
+  counted and must be released with their own destroy functions, never with
+  delete, so std::unique_ptr needs a deleter to hold them.
+ */
+class LeptDeleter {
+public:
+  void operator()(PIX *pix) { pixDestroy(&pix); }
+  void operator()(PIXA *pixa) { pixaDestroy(&pixa); }
+  void operator()(BOX *box) { boxDestroy(&box); }
+  void operator()(BOXA *boxa) { boxaDestroy(&boxa); }
+  void operator()(BOXAA *boxaa) { boxaaDestroy(&boxaa); }
+};
+
+typedef std::unique_ptr<PIX, LeptDeleter> PixPtr;
+typedef std::unique_ptr<PIXA, LeptDeleter> PixaPtr;
+typedef std::unique_ptr<BOX, LeptDeleter> BoxPtr;
+typedef std::unique_ptr<BOXA, LeptDeleter> BoxaPtr;
+typedef std::unique_ptr<BOXAA, LeptDeleter> BoxaaPtr;
+
+/**
+  Holds a reference to each object added to it and releases them all together,
+  for objects that are shared between the stages of processing a page and so
+  have no single owner. Objects that were cloned elsewhere survive until their
+  other references are released as well.
+ */
+class LeptArena {
+public:
+  LeptArena();
+
+  // Releases everything still held
+  ~LeptArena();
+
+  // Each add takes ownership of its argument and returns it, so allocations
+  // can be wrapped in place. NULL is ignored.
+  PIX *add(PIX *pix);
+  PIXA *add(PIXA *pixa);
+  BOX *add(BOX *box);
+  BOXA *add(BOXA *boxa);
+  BOXAA *add(BOXAA *boxaa);
+
+  // Releases everything added so far, the arena can be re-used afterwards
+  void release();
+
+private:
+  LeptArena(const LeptArena &);
+  LeptArena &operator=(const LeptArena &);
+
+  std::vector<PIX *> pixs;
+  std::vector<PIXA *> pixas;
+  std::vector<BOX *> boxes;
+  std::vector<BOXA *> boxas;
+  std::vector<BOXAA *> boxaas;
+};
+
+#endif /* defined(__figureextractor__LeptHandles__) */
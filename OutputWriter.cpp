@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "OutputWriter.h"
+#include "Profiler.h"
+
+ImageFormat::ImageFormat() : format(IFF_PNG), pngLevel(-1), quality(90) {}
+
+const char *ImageFormat::getExtension() const {
+  switch (format) {
+  case IFF_JFIF_JPEG:
+    return ".jpg";
+  case IFF_WEBP:
+    return ".webp";
+  default:
+    return ".png";
+  }
+}
+
+OutputWriter::OutputWriter(int nThreads, size_t maxQueued,
+                           SyncPolicy syncPolicy)
+    : syncPolicy(syncPolicy), maxQueued(std::max<size_t>(maxQueued, 1)),
+      active(0), stopping(false) {
+  for (int i = 0; i < std::max(nThreads, 1); ++i) {
+    threads.push_back(std::thread(&OutputWriter::work, this));
+  }
+}
+
+OutputWriter::~OutputWriter() {
+  finish();
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    stopping = true;
+  }
+  notEmpty.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+bool OutputWriter::openArchive(const std::string &path) {
+  return archive.open(path);
+}
+
+bool OutputWriter::isArchiving() { return archive.isOpen(); }
+
+bool OutputWriter::getArchiveEntry(const std::string &path, uint64_t *offset,
+                                   uint64_t *length) {
+  std::unique_lock<std::mutex> guard(lock);
+  std::map<std::string, std::pair<uint64_t, uint64_t>>::iterator entry =
+      archiveEntries.find(path);
+  if (entry == archiveEntries.end())
+    return false;
+  *offset = entry->second.first;
+  *length = entry->second.second;
+  return true;
+}
+
+void OutputWriter::writeImage(const std::string &path, PIX *pix,
+                              const ImageFormat &format) {
+  Job job;
+  job.path = path;
+  job.image = true;
+  job.pix = pix;
+  job.format = format;
+  enqueue(job);
+}
+
+void OutputWriter::writeEncodedImage(const std::string &path,
+                                     const std::string &data) {
+  Job job;
+  job.path = path;
+  job.image = true;
+  job.pix = NULL;
+  job.data = data;
+  enqueue(job);
+}
+
+void OutputWriter::writeData(const std::string &path, const std::string &data) {
+  Job job;
+  job.path = path;
+  job.image = false;
+  job.pix = NULL;
+  job.data = data;
+  enqueue(job);
+}
+
+void OutputWriter::enqueue(Job &job) {
+  std::unique_lock<std::mutex> guard(lock);
+  notFull.wait(guard, [&]() { return queue.size() < maxQueued; });
+  queue.push_back(job);
+  notEmpty.notify_one();
+}
+
+void OutputWriter::wait() {
+  std::unique_lock<std::mutex> guard(lock);
+  idle.wait(guard, [&]() { return queue.empty() and active == 0; });
+}
+
+bool OutputWriter::finish() {
+  wait();
+  std::vector<std::string> paths = std::vector<std::string>();
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    paths.swap(toSync);
+  }
+  if (syncPolicy == SYNC_BATCH and archive.isOpen() and not archive.sync())
+    addError(std::string("Could not sync archive: ") + strerror(errno));
+  for (const std::string &path : paths) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0 or fsync(fd) != 0)
+      addError("Could not sync " + path + ": " + strerror(errno));
+    if (fd >= 0)
+      close(fd);
+  }
+  std::unique_lock<std::mutex> guard(lock);
+  return errors.empty();
+}
+
+const std::vector<std::string> &OutputWriter::getErrors() { return errors; }
+
+void OutputWriter::addError(const std::string &error) {
+  std::unique_lock<std::mutex> guard(lock);
+  errors.push_back(error);
+}
+
+void OutputWriter::work() {
+  PROFILE_THREAD("writer");
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      notEmpty.wait(guard, [&]() { return stopping or not queue.empty(); });
+      if (queue.empty())
+        return;
+      job = queue.front();
+      queue.pop_front();
+      active += 1;
+    }
+    notFull.notify_one();
+    writeFile(job);
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      active -= 1;
+      if (queue.empty() and active == 0)
+        idle.notify_all();
+    }
+  }
+}
+
+bool OutputWriter::encode(Job &job, l_uint8 **encoded, size_t *size) {
+  PROFILE_SCOPE("encode");
+  int failed;
+  switch (job.format.format) {
+  case IFF_JFIF_JPEG:
+    failed = pixWriteMemJpeg(encoded, size, job.pix, job.format.quality, 0);
+    break;
+  case IFF_WEBP:
+    // Fails if leptonica was built without libwebp
+    failed = pixWriteMemWebP(encoded, size, job.pix, job.format.quality, 0);
+    break;
+  default:
+    if (job.format.pngLevel >= 0)
+      pixSetZlibCompression(job.pix, job.format.pngLevel);
+    failed = pixWriteMem(encoded, size, job.pix, IFF_PNG);
+    break;
+  }
+  return not failed and *encoded != NULL;
+}
+
+void OutputWriter::writeFile(Job &job) {
+  const char *data = job.data.data();
+  size_t size = job.data.size();
+  l_uint8 *encoded = NULL;
+  if (job.pix != NULL) {
+    bool ok = encode(job, &encoded, &size);
+    pixDestroy(&job.pix);
+    if (not ok) {
+      addError("Could not encode " + job.path);
+      return;
+    }
+    data = (const char *)encoded;
+  }
+  if (job.image and archive.isOpen()) {
+    writeArchive(job, data, size);
+    if (encoded != NULL)
+      lept_free(encoded);
+    return;
+  }
+
+  PROFILE_SCOPE("write");
+  std::string error = "";
+  int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    error = strerror(errno);
+  } else {
+    size_t written = 0;
+    while (written < size and error.length() == 0) {
+      ssize_t n = write(fd, data + written, size - written);
+      if (n < 0 and errno != EINTR)
+        error = strerror(errno);
+      else if (n > 0)
+        written += n;
+    }
+    if (error.length() == 0 and syncPolicy == SYNC_EACH and fsync(fd) != 0)
+      error = strerror(errno);
+    if (close(fd) != 0 and error.length() == 0)
+      error = strerror(errno);
+  }
+  if (encoded != NULL)
+    lept_free(encoded);
+
+  if (error.length() != 0) {
+    addError("Could not write " + job.path + ": " + error);
+  } else if (syncPolicy == SYNC_BATCH) {
+    std::unique_lock<std::mutex> guard(lock);
+    toSync.push_back(job.path);
+  }
+}
+
+void OutputWriter::writeArchive(Job &job, const char *data, size_t size) {
+  // Members are named like the files they replace, but must be relative
+  std::string name = job.path;
+  while (name.length() != 0 and name[0] == '/')
+    name = name.substr(1);
+  uint64_t offset;
+  PROFILE_SCOPE("write");
+  std::unique_lock<std::mutex> guard(archiveLock);
+  if (not archive.append(name, data, size, &offset)) {
+    addError("Could not add " + name + " to the archive");
+    return;
+  }
+  if (syncPolicy == SYNC_EACH and not archive.sync()) {
+    addError(std::string("Could not sync archive: ") + strerror(errno));
+    return;
+  }
+  guard.unlock();
+  std::unique_lock<std::mutex> entriesGuard(lock);
+  archiveEntries[job.path] = std::pair<uint64_t, uint64_t>(offset, size);
+}
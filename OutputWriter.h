@@ -0,0 +1,132 @@
+#ifndef __figureextractor__OutputWriter__
+#define __figureextractor__OutputWriter__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <leptonica/allheaders.h>
+
+#include "TarArchive.h"
+
+// How images are encoded
+class ImageFormat {
+public:
+  // PNG with leptonica's default compression
+  ImageFormat();
+
+  // IFF_PNG, IFF_JFIF_JPEG or IFF_WEBP
+  int format;
+  // zlib level (0-9) for PNG, -1 for the default
+  int pngLevel;
+  // 1-100, for JPEG and WebP
+  int quality;
+
+  // File extension including the '.'
+  const char *getExtension() const;
+};
+
+/**
+  Encodes and writes output files on background threads so page processing
+  does not wait on the disk. Each file is encoded in memory and written with a
+  single write call. The queue is bounded, so producers block once too many
+  writes are pending instead of holding every page's images in memory.
+
+  Failures are recorded rather than reported immediately, call finish() to wait
+  for pending writes and find out if any failed.
+ */
+class OutputWriter {
+public:
+  enum SyncPolicy {
+    // Leave flushing to the OS
+    SYNC_NONE,
+    // fsync each file before closing it
+    SYNC_EACH,
+    // fsync every file written once all writes are done, so writes are not
+    // serialized behind the syncs
+    SYNC_BATCH
+  };
+
+  OutputWriter(int nThreads, size_t maxQueued, SyncPolicy syncPolicy);
+
+  // Waits for pending writes
+  ~OutputWriter();
+
+  // Makes images be appended to the tar archive at path instead of being
+  // written to their own files, returns false if the archive could not be
+  // opened. Must be called before anything is queued.
+  bool openArchive(const std::string &path);
+
+  bool isArchiving();
+
+  // Finds where the data of the image queued as path was stored in the
+  // archive. Only valid once the image is written, see wait().
+  bool getArchiveEntry(const std::string &path, uint64_t *offset,
+                       uint64_t *length);
+
+  // Queues pix to be encoded in the given format and written to path, takes
+  // ownership of pix. Images are encoded on the writer threads, so several
+  // images are encoded in parallel.
+  void writeImage(const std::string &path, PIX *pix, const ImageFormat &format);
+
+  // Queues an already encoded image to be written to path
+  void writeEncodedImage(const std::string &path, const std::string &data);
+
+  // Queues data to be written to path
+  void writeData(const std::string &path, const std::string &data);
+
+  // Waits for all queued writes
+  void wait();
+
+  // Waits for all queued writes and syncs them if needed, returns false if
+  // any failed
+  bool finish();
+
+  const std::vector<std::string> &getErrors();
+
+private:
+  class Job {
+  public:
+    std::string path;
+    // Images are added to the archive when there is one
+    bool image;
+    PIX *pix;
+    ImageFormat format;
+    std::string data;
+  };
+
+  void enqueue(Job &job);
+
+  void work();
+
+  bool encode(Job &job, l_uint8 **encoded, size_t *size);
+
+  void writeFile(Job &job);
+
+  void writeArchive(Job &job, const char *data, size_t size);
+
+  void addError(const std::string &error);
+
+  SyncPolicy syncPolicy;
+  size_t maxQueued;
+  std::mutex lock;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  std::condition_variable idle;
+  std::deque<Job> queue;
+  int active;
+  bool stopping;
+  std::vector<std::thread> threads;
+  std::vector<std::string> errors;
+  std::vector<std::string> toSync;
+  TarArchive archive;
+  // Guards archive, so images are still encoded in parallel
+  std::mutex archiveLock;
+  std::map<std::string, std::pair<uint64_t, uint64_t>> archiveEntries;
+};
+
+#endif /* defined(__figureextractor__OutputWriter__) */
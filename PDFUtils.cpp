@@ -1,33 +1,259 @@
 #include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stdexcept>
 
+#include <unistd.h>
+
+#include <ErrorCodes.h>
 #include <PDFDoc.h>
 #include <SplashOutputDev.h>
 #include <splash/SplashBitmap.h>
 #include <Page.h>
 
 #include "PDFUtils.h"
+#include "ResultCache.h"
+#include "Profiler.h"
 
 CaptionStart::CaptionStart(int page, int number, TextWord *word,
                            FigureType type)
     : page(page), type(type), number(number), word(word) {}
 
+namespace {
+
+// Adds a reference to box, which can be NULL
+BOX *cloneBox(BOX *box) { return box == NULL ? NULL : boxClone(box); }
+
+} // end namespace
+
 Caption::Caption(CaptionStart captionStart, BOX *boundingBox)
     : page(captionStart.page), number(captionStart.number),
-      type(captionStart.type), boundingBox(boxCopy(boundingBox)) {}
+      type(captionStart.type), boundingBox(boundingBox) {}
 
 Caption::Caption(int page, int number, FigureType type, BOX *boundingBox)
-    : page(page), number(number), type(type),
-      boundingBox(boxCopy(boundingBox)) {}
+    : page(page), number(number), type(type), boundingBox(boundingBox) {}
+
+Caption::Caption(const Caption &other)
+    : page(other.page), number(other.number), type(other.type),
+      boundingBox(cloneBox(other.boundingBox)) {}
+
+Caption &Caption::operator=(const Caption &other) {
+  BOX *box = cloneBox(other.boundingBox);
+  boxDestroy(&boundingBox);
+  page = other.page;
+  number = other.number;
+  type = other.type;
+  boundingBox = box;
+  return *this;
+}
+
+Caption::~Caption() { boxDestroy(&boundingBox); }
 
 Figure::Figure(Caption caption, BOX *imageBB)
     : type(caption.type), page(caption.page), number(caption.number),
-      imageBB(imageBB), captionBB(caption.boundingBox) {}
+      imageBB(imageBB), captionBB(cloneBox(caption.boundingBox)) {}
 
 Figure::Figure(CaptionStart captionStart)
     : type(captionStart.type), page(captionStart.page),
       number(captionStart.number), imageBB(NULL), captionBB(NULL) {}
 
+Figure::Figure(const Figure &other)
+    : type(other.type), page(other.page), number(other.number),
+      imageBB(cloneBox(other.imageBB)), captionBB(cloneBox(other.captionBB)) {}
+
+Figure &Figure::operator=(const Figure &other) {
+  BOX *image = cloneBox(other.imageBB);
+  BOX *caption = cloneBox(other.captionBB);
+  boxDestroy(&imageBB);
+  boxDestroy(&captionBB);
+  type = other.type;
+  page = other.page;
+  number = other.number;
+  imageBB = image;
+  captionBB = caption;
+  return *this;
+}
+
+Figure::~Figure() {
+  boxDestroy(&imageBB);
+  boxDestroy(&captionBB);
+}
+
+namespace {
+
+void writeBox(BOX *box, std::ostream &output) {
+  if (box == NULL)
+    output << " 0";
+  else
+    output << " 1 " << box->x << " " << box->y << " " << box->w << " "
+           << box->h;
+}
+
+bool readBox(std::istream &input, BOX **box) {
+  int present, x, y, w, h;
+  *box = NULL;
+  if (not(input >> present))
+    return false;
+  if (present == 0)
+    return true;
+  if (not(input >> x >> y >> w >> h))
+    return false;
+  *box = boxCreate(x, y, w, h);
+  return true;
+}
+
+} // end namespace
+
+void writeFigures(const std::vector<Figure> &figures, std::ostream &output) {
+  output << figures.size() << "\n";
+  for (const Figure &fig : figures) {
+    output << fig.page << " " << fig.number << " " << fig.type;
+    writeBox(fig.imageBB, output);
+    writeBox(fig.captionBB, output);
+    output << "\n";
+  }
+}
+
+bool readFigures(std::istream &input, std::vector<Figure> &figures) {
+  size_t nFigures;
+  if (not(input >> nFigures))
+    return false;
+  for (size_t i = 0; i < nFigures; ++i) {
+    int page, number, type;
+    if (not(input >> page >> number >> type) or
+        (type != FIGURE and type != TABLE))
+      return false;
+    // Boxes are read straight into the figure so it frees them on failure
+    Figure fig = Figure(CaptionStart(page, number, NULL, (FigureType)type));
+    if (not readBox(input, &fig.imageBB) or not readBox(input, &fig.captionBB))
+      return false;
+    figures.push_back(fig);
+  }
+  return true;
+}
+
+PageFingerprinter::PageFingerprinter(PDFDoc *doc) : doc(doc) {}
+
+uint64_t PageFingerprinter::getFingerprint(int page) {
+  Page *p = doc->getPage(page);
+  uint64_t hash = hashBytes(NULL, 0);
+  // Boxes, rotation and resources can be inherited from the page tree so use
+  // the resolved values, but do not follow /Parent which would pull in every
+  // other page
+  double boxes[8] = {
+      p->getMediaBox()->x1, p->getMediaBox()->y1, p->getMediaBox()->x2,
+      p->getMediaBox()->y2, p->getCropBox()->x1,  p->getCropBox()->y1,
+      p->getCropBox()->x2,  p->getCropBox()->y2};
+  int rotate = p->getRotate();
+  hash = hashBytes(boxes, sizeof(boxes), hash);
+  hash = hashBytes(&rotate, sizeof(rotate), hash);
+  if (p->getResourceDict() != NULL)
+    hash = hashDict(p->getResourceDict(), hash, NULL);
+  Ref ref = p->getRef();
+  Object pageObj;
+  doc->getXRef()->fetch(ref.num, ref.gen, &pageObj);
+  if (pageObj.isDict()) {
+    inProgress.insert(std::make_pair(ref.num, ref.gen));
+    hash = hashDict(pageObj.getDict(), hash, "Parent");
+    inProgress.erase(std::make_pair(ref.num, ref.gen));
+  }
+  pageObj.free();
+  return hash;
+}
+
+uint64_t PageFingerprinter::hashDict(Dict *dict, uint64_t hash,
+                                     const char *skipKey) {
+  for (int i = 0; i < dict->getLength(); ++i) {
+    const char *key = dict->getKey(i);
+    if (skipKey != NULL and strcmp(key, skipKey) == 0)
+      continue;
+    hash = hashBytes(key, strlen(key) + 1, hash);
+    Object value;
+    dict->getValNF(i, &value);
+    hash = hashObject(&value, hash);
+    value.free();
+  }
+  return hash;
+}
+
+uint64_t PageFingerprinter::hashObject(Object *obj, uint64_t hash) {
+  int type = obj->getType();
+  hash = hashBytes(&type, sizeof(type), hash);
+  switch (obj->getType()) {
+  case objBool: {
+    bool value = obj->getBool();
+    return hashBytes(&value, sizeof(value), hash);
+  }
+  case objInt: {
+    int value = obj->getInt();
+    return hashBytes(&value, sizeof(value), hash);
+  }
+  case objReal: {
+    double value = obj->getReal();
+    return hashBytes(&value, sizeof(value), hash);
+  }
+  case objString:
+    return hashBytes(obj->getString()->getCString(),
+                     obj->getString()->getLength(), hash);
+  case objName:
+    return hashBytes(obj->getName(), strlen(obj->getName()), hash);
+  case objArray:
+    for (int i = 0; i < obj->arrayGetLength(); ++i) {
+      Object elem;
+      obj->arrayGetNF(i, &elem);
+      hash = hashObject(&elem, hash);
+      elem.free();
+    }
+    return hash;
+  case objDict:
+    return hashDict(obj->getDict(), hash, NULL);
+  case objStream: {
+    hash = hashDict(obj->streamGetDict(), hash, NULL);
+    Stream *raw = obj->getStream()->getUndecodedStream();
+    raw->reset();
+    unsigned char buf[4096];
+    int n = 0;
+    int c;
+    while ((c = raw->getChar()) != EOF) {
+      buf[n++] = (unsigned char)c;
+      if (n == sizeof(buf)) {
+        hash = hashBytes(buf, n, hash);
+        n = 0;
+      }
+    }
+    raw->close();
+    return hashBytes(buf, n, hash);
+  }
+  case objRef: {
+    std::pair<int, int> ref =
+        std::make_pair(obj->getRefNum(), obj->getRefGen());
+    std::map<std::pair<int, int>, uint64_t>::iterator cached =
+        refHashes.find(ref);
+    if (cached != refHashes.end())
+      return hashBytes(&cached->second, sizeof(uint64_t), hash);
+    // Cycles are cut off, and references to other pages (for example link
+    // destinations) do not change how this page looks
+    if (inProgress.count(ref) != 0)
+      return hash;
+    Object target;
+    doc->getXRef()->fetch(ref.first, ref.second, &target);
+    uint64_t refHash;
+    if (target.isDict("Page") or target.isDict("Pages")) {
+      refHash = hashBytes(NULL, 0);
+    } else {
+      inProgress.insert(ref);
+      refHash = hashObject(&target, hashBytes(NULL, 0));
+      inProgress.erase(ref);
+    }
+    target.free();
+    refHashes[ref] = refHash;
+    return hashBytes(&refHash, sizeof(uint64_t), hash);
+  }
+  default:
+    return hash;
+  }
+}
+
 void displayBox(PIX *pix, BOX *box) {
   BOXA *tmp = boxaCreate(1);
   boxaAddBox(tmp, box, L_CLONE);
@@ -97,6 +323,280 @@ private:
   bool filled;
 };
 
+// OutputDevice that records the bounding boxes of the graphical elements of a
+// page in device space, an approximation of the connected components of a
+// graphics only render that is much cheaper to compute
+class GraphicBoxesDev : public OutputDev {
+public:
+  GraphicBoxesDev() : boxes(boxaCreate(0)), width(0), height(0) {}
+
+  ~GraphicBoxesDev() { boxaDestroy(&boxes); }
+
+  GBool upsideDown() { return gTrue; }
+  GBool useDrawChar() { return gFalse; }
+  GBool interpretType3Chars() { return gFalse; }
+
+  virtual void startPage(int pageNum, GfxState *state, XRef *xref) {
+    width = (int)(state->getPageWidth() + 0.5);
+    height = (int)(state->getPageHeight() + 0.5);
+  }
+
+  virtual void stroke(GfxState *state) {
+    GfxGray gray;
+    state->getStrokeGray(&gray);
+    addPath(state, state->getTransformedLineWidth() / 2.0, gray);
+  }
+
+  virtual void fill(GfxState *state) {
+    GfxGray gray;
+    state->getFillGray(&gray);
+    addPath(state, 0, gray);
+  }
+
+  virtual void eoFill(GfxState *state) { fill(state); }
+
+  virtual void drawImageMask(GfxState *state, Object *ref, Stream *str,
+                             int width, int height, GBool invert,
+                             GBool interpolate, GBool inlineImg) {
+    addImage(state);
+  }
+
+  virtual void drawImage(GfxState *state, Object *ref, Stream *str, int width,
+                         int height, GfxImageColorMap *colorMap,
+                         GBool interpolate, int *maskColors, GBool inlineImg) {
+    addImage(state);
+  }
+
+  virtual void drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+                               int width, int height,
+                               GfxImageColorMap *colorMap, GBool interpolate,
+                               Stream *maskStr, int maskWidth, int maskHeight,
+                               GBool maskInvert, GBool maskInterpolate) {
+    addImage(state);
+  }
+
+  virtual void
+  drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str, int width,
+                      int height, GfxImageColorMap *colorMap, GBool interpolate,
+                      Stream *maskStr, int maskWidth, int maskHeight,
+                      GfxImageColorMap *maskColorMap, GBool maskInterpolate) {
+    addImage(state);
+  }
+
+  BOXA *takeBoxes() {
+    BOXA *taken = boxes;
+    boxes = boxaCreate(0);
+    return taken;
+  }
+
+private:
+  void addPath(GfxState *state, double pad, GfxGray gray) {
+    // Near white marks do not survive binarizing a render
+    if (colToByte(gray) >= 250)
+      return;
+    GfxPath *path = state->getPath();
+    double xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+    for (int i = 0; i < path->getNumSubpaths(); ++i) {
+      GfxSubpath *subpath = path->getSubpath(i);
+      for (int j = 0; j < subpath->getNumPoints(); ++j) {
+        double x, y;
+        state->transform(subpath->getX(j), subpath->getY(j), &x, &y);
+        if (xMax < xMin) {
+          xMin = xMax = x;
+          yMin = yMax = y;
+        } else {
+          xMin = std::min(xMin, x);
+          xMax = std::max(xMax, x);
+          yMin = std::min(yMin, y);
+          yMax = std::max(yMax, y);
+        }
+      }
+    }
+    if (xMax >= xMin)
+      addBox(state, xMin - pad, yMin - pad, xMax + pad, yMax + pad);
+  }
+
+  void addImage(GfxState *state) {
+    // Images fill the unit square of user space
+    double xs[4], ys[4];
+    state->transform(0, 0, &xs[0], &ys[0]);
+    state->transform(1, 0, &xs[1], &ys[1]);
+    state->transform(0, 1, &xs[2], &ys[2]);
+    state->transform(1, 1, &xs[3], &ys[3]);
+    addBox(state, *std::min_element(xs, xs + 4), *std::min_element(ys, ys + 4),
+           *std::max_element(xs, xs + 4), *std::max_element(ys, ys + 4));
+  }
+
+  void addBox(GfxState *state, double xMin, double yMin, double xMax,
+              double yMax) {
+    double cxMin, cyMin, cxMax, cyMax;
+    state->getClipBBox(&cxMin, &cyMin, &cxMax, &cyMax);
+    int x = std::max((int)std::floor(std::max(xMin, cxMin)), 0);
+    int y = std::max((int)std::floor(std::max(yMin, cyMin)), 0);
+    int x2 = std::min((int)std::ceil(std::min(xMax, cxMax)), width - 1);
+    int y2 = std::min((int)std::ceil(std::min(yMax, cyMax)), height - 1);
+    if (x2 < x or y2 < y)
+      return;
+    BOX *box = boxCreate(x, y, x2 - x + 1, y2 - y + 1);
+    boxaAddBox(boxes, box, L_INSERT);
+  }
+
+  BOXA *boxes;
+  int width;
+  int height;
+};
+
+// OutputDevice that looks for embedded images that cover a figure's region
+// by themselves and extracts them at their own resolution. Nothing is
+// rendered, only the streams of matching images are read.
+class NativeImageDev : public OutputDev {
+public:
+  NativeImageDev(std::vector<Figure> &figures, bool passJPEG,
+                 std::vector<NativeImage> &images)
+      : figures(figures), passJPEG(passJPEG), images(images) {}
+
+  GBool upsideDown() { return gTrue; }
+  GBool useDrawChar() { return gFalse; }
+  GBool interpretType3Chars() { return gFalse; }
+
+  // Images drawn with masks or color keys are skipped, they only look right
+  // composited over the page
+  virtual void drawImage(GfxState *state, Object *ref, Stream *str, int width,
+                         int height, GfxImageColorMap *colorMap,
+                         GBool interpolate, int *maskColors, GBool inlineImg) {
+    if (inlineImg or maskColors != NULL)
+      return;
+    // Only images drawn upright or flipped can be saved without resampling
+    double *ctm = state->getCTM();
+    double scale = std::fabs(ctm[0]) + std::fabs(ctm[3]);
+    if (scale == 0 or std::fabs(ctm[1]) > 1e-6 * scale or
+        std::fabs(ctm[2]) > 1e-6 * scale)
+      return;
+    double xMin = std::min(ctm[4], ctm[4] + ctm[0]);
+    double xMax = std::max(ctm[4], ctm[4] + ctm[0]);
+    double yMin = std::min(ctm[5], ctm[5] + ctm[3]);
+    double yMax = std::max(ctm[5], ctm[5] + ctm[3]);
+    // A clipped image shows less than its stream holds
+    double cxMin, cyMin, cxMax, cyMax;
+    state->getClipBBox(&cxMin, &cyMin, &cxMax, &cyMax);
+    if (cxMin > xMin + 1 or cyMin > yMin + 1 or cxMax < xMax - 1 or
+        cyMax < yMax - 1)
+      return;
+
+    for (size_t i = 0; i < figures.size(); ++i) {
+      BOX *bb = figures[i].imageBB;
+      if (bb == NULL or images[i].pix != NULL or images[i].jpeg.length() != 0)
+        continue;
+      double ix = std::min(xMax, (double)bb->x + bb->w) -
+                  std::max(xMin, (double)bb->x);
+      double iy = std::min(yMax, (double)bb->y + bb->h) -
+                  std::max(yMin, (double)bb->y);
+      if (ix <= 0 or iy <= 0)
+        continue;
+      double overlap = ix * iy;
+      // The image has to be the figure, not part of it or a backdrop
+      if (overlap < minCoverage * bb->w * bb->h or
+          overlap < minCoverage * (xMax - xMin) * (yMax - yMin))
+        continue;
+      bool upright = ctm[0] > 0 and ctm[3] < 0;
+      if (passJPEG and upright and isPlainJPEG(str, colorMap))
+        images[i].jpeg = readUndecoded(str);
+      if (images[i].jpeg.length() == 0)
+        images[i].pix =
+            decode(str, width, height, colorMap, ctm[0] < 0, ctm[3] > 0);
+      return;
+    }
+  }
+
+  // Masked images are left to the rendered crop, the default implementations
+  // would pass them on to drawImage without their masks
+  virtual void drawImageMask(GfxState *state, Object *ref, Stream *str,
+                             int width, int height, GBool invert,
+                             GBool interpolate, GBool inlineImg) {}
+
+  virtual void drawMaskedImage(GfxState *state, Object *ref, Stream *str,
+                               int width, int height,
+                               GfxImageColorMap *colorMap, GBool interpolate,
+                               Stream *maskStr, int maskWidth, int maskHeight,
+                               GBool maskInvert, GBool maskInterpolate) {}
+
+  virtual void
+  drawSoftMaskedImage(GfxState *state, Object *ref, Stream *str, int width,
+                      int height, GfxImageColorMap *colorMap, GBool interpolate,
+                      Stream *maskStr, int maskWidth, int maskHeight,
+                      GfxImageColorMap *maskColorMap, GBool maskInterpolate) {}
+
+private:
+  static constexpr double minCoverage = 0.95;
+
+  // True if the image is only DCT encoded and its colors can be used as is
+  bool isPlainJPEG(Stream *str, GfxImageColorMap *colorMap) {
+    if (str->getKind() != strDCT or
+        str->getNextStream() != str->getBaseStream())
+      return false;
+    GfxColorSpaceMode mode = colorMap->getColorSpace()->getMode();
+    if (mode != csDeviceRGB and mode != csDeviceGray)
+      return false;
+    for (int i = 0; i < colorMap->getNumPixelComps(); ++i) {
+      if (colorMap->getDecodeLow(i) != 0 or colorMap->getDecodeHigh(i) != 1)
+        return false;
+    }
+    return true;
+  }
+
+  std::string readUndecoded(Stream *str) {
+    Stream *raw = str->getUndecodedStream();
+    std::string data = std::string();
+    Guchar buf[4096];
+    raw->reset();
+    int n;
+    while ((n = raw->getChars(sizeof(buf), buf)) > 0)
+      data.append((const char *)buf, n);
+    raw->close();
+    return data;
+  }
+
+  PIX *decode(Stream *str, int width, int height, GfxImageColorMap *colorMap,
+              bool flipX, bool flipY) {
+    PIX *pix = pixCreate(width, height, 32);
+    if (pix == NULL)
+      return NULL;
+    ImageStream *imgStr = new ImageStream(str, width,
+                                          colorMap->getNumPixelComps(),
+                                          colorMap->getBits());
+    imgStr->reset();
+    std::vector<unsigned int> rgb = std::vector<unsigned int>(width);
+    l_uint32 *data = pixGetData(pix);
+    int wpl = pixGetWpl(pix);
+    bool ok = true;
+    for (int y = 0; y < height and ok; ++y) {
+      Guchar *line = imgStr->getLine();
+      ok = line != NULL;
+      if (ok) {
+        // poppler packs pixels as 0x00RRGGBB, leptonica as 0xRRGGBBAA
+        colorMap->getRGBLine(line, &rgb[0], width);
+        for (int x = 0; x < width; ++x)
+          data[y * wpl + x] = (rgb[x] << 8) | 0xff;
+      }
+    }
+    imgStr->close();
+    delete imgStr;
+    if (not ok) {
+      pixDestroy(&pix);
+      return NULL;
+    }
+    if (flipX)
+      pixFlipLR(pix, pix);
+    if (flipY)
+      pixFlipTB(pix, pix);
+    return pix;
+  }
+
+  std::vector<Figure> &figures;
+  bool passJPEG;
+  std::vector<NativeImage> &images;
+};
+
 // OutputDevice that ignores characters
 class SplashGraphicsOutputDev : public SplashOutputDev {
 
@@ -149,7 +649,7 @@ PIX *bitmapToPix(SplashBitmap *bitmap) {
   if (bitmap->getMode() != splashModeMono8)
     return NULL;
   PIX *pix = pixCreate(bitmap->getWidth(), bitmap->getHeight(), 8);
-  SplashColorPtr pixel = new Guchar[1];
+  SplashColor pixel;
   for (int x = 0; x < bitmap->getWidth(); ++x) {
     for (int y = 0; y < bitmap->getHeight(); ++y) {
       bitmap->getPixel(x, y, pixel);
@@ -163,7 +663,7 @@ PIX *fullColorBitmapToPix(SplashBitmap *bitmap) {
   if (bitmap->getMode() != splashModeRGB8)
     return NULL;
   PIX *pix = pixCreate(bitmap->getWidth(), bitmap->getHeight(), 32);
-  SplashColorPtr pixel = new Guchar[3];
+  SplashColor pixel;
   for (int x = 0; x < bitmap->getWidth(); ++x) {
     for (int y = 0; y < bitmap->getHeight(); ++y) {
       bitmap->getPixel(x, y, pixel);
@@ -197,56 +697,98 @@ PIX *getFullColorPix(SplashOutputDev *splashOut, PDFDoc *doc, int page, double d
   return fullColorBitmapToPix(splashOut->getBitmap());
 }
 
-std::unique_ptr<PIX> getFullRenderPix(PDFDoc *doc, int page, double dpi) {
+PixPtr getFullRenderPix(PDFDoc *doc, int page, double dpi) {
+  PROFILE_SCOPE("render");
+  PROFILE_COUNT("pages rendered", 1);
   SplashColor paperColor = {255, 255, 255};
   SplashOutputDev *splashOut =
     new SplashOutputDev(splashModeMono8, 4, gFalse, paperColor);
-  std::unique_ptr<PIX> output(getPix(splashOut, doc, page, dpi));
+  PixPtr output(getPix(splashOut, doc, page, dpi));
   delete splashOut;
   return output;
 }
 
-std::unique_ptr<PIX> getGraphicOnlyPix(PDFDoc *doc, int page, double dpi) {
+PixPtr getGraphicOnlyPix(PDFDoc *doc, int page, double dpi) {
+  PROFILE_SCOPE("render graphics");
   SplashColor paperColor = {255, 255, 255};
   SplashGraphicsOutputDev *splashOut =
       new SplashGraphicsOutputDev(splashModeMono8, 4, gFalse, paperColor);
-  std::unique_ptr<PIX> output(getPix(splashOut, doc, page, dpi));
+  PixPtr output(getPix(splashOut, doc, page, dpi));
   delete splashOut;
   return output;
 }
 
-std::unique_ptr<PIX> getFullColorRenderPix(PDFDoc *doc, int page, double dpi) {
+PixPtr getFullColorRenderPix(PDFDoc *doc, int page, double dpi) {
+  PROFILE_SCOPE("render color");
+  PROFILE_COUNT("pages rendered in color", 1);
   SplashColor paperColor = {255, 255, 255};
   SplashOutputDev *splashOut =
     new SplashOutputDev(splashModeRGB8, 4, gFalse, paperColor);
-  std::unique_ptr<PIX> output(getFullColorPix(splashOut, doc, page, dpi));
+  PixPtr output(getFullColorPix(splashOut, doc, page, dpi));
   delete splashOut;
   return output;
 }
 
+NativeImage::NativeImage() : jpeg(""), pix(NULL) {}
+
+void getNativeImages(PDFDoc *doc, int page, double dpi,
+                     std::vector<Figure> &figures, bool passJPEG,
+                     std::vector<NativeImage> &images) {
+  PROFILE_SCOPE("native images");
+  images = std::vector<NativeImage>(figures.size());
+  NativeImageDev *dev = new NativeImageDev(figures, passJPEG, images);
+  doc->displayPage(dev, page, dpi, dpi, 0, gTrue, gFalse, gFalse);
+  delete dev;
+}
+
+BOXA *getGraphicBoxes(PDFDoc *doc, int page, double dpi) {
+  PROFILE_SCOPE("graphic boxes");
+  GraphicBoxesDev *dev = new GraphicBoxesDev();
+  doc->displayPage(dev, page, dpi, dpi, 0, gTrue, gFalse, gFalse);
+  BOXA *boxes = dev->takeBoxes();
+  delete dev;
+  return boxes;
+}
+
+void getPageSize(PDFDoc *doc, int page, double dpi, int *width, int *height) {
+  // Matches the size of the bitmaps SplashOutputDev renders
+  double w = doc->getPageMediaWidth(page) * dpi / 72.0;
+  double h = doc->getPageMediaHeight(page) * dpi / 72.0;
+  if (doc->getPageRotate(page) == 90 or doc->getPageRotate(page) == 270)
+    std::swap(w, h);
+  *width = std::max((int)(w + 0.5), 1);
+  *height = std::max((int)(h + 0.5), 1);
+}
+
+TextPage *getTextPage(PDFDoc *doc, int page, double dpi) {
+  PROFILE_SCOPE("text");
+  // TOOD should not need to rebuild this each time
+  TextOutputDev *output = new TextOutputDev(NULL, gFalse, 0, gFalse, gFalse);
+  doc->displayPage(output, page, dpi, dpi, 0, gFalse, gFalse, gFalse);
+  TextPage *text = output->takeText();
+  delete output;
+  return text;
+}
+
 std::vector<TextPage *> getTextPages(PDFDoc *doc, double dpi) {
   std::vector<TextPage *> text = std::vector<TextPage *>();
   for (int i = 1; i <= doc->getNumPages(); ++i) {
-    // TOOD should not need to rebuild this each time
-    TextOutputDev *output = new TextOutputDev(NULL, gFalse, 0, gFalse, gFalse);
-    doc->displayPage(output, i, dpi, dpi, 0, gFalse, gFalse, gFalse);
-    text.push_back(output->takeText());
-    delete output;
+    text.push_back(getTextPage(doc, i, dpi));
   }
   return text;
 }
 
 PIX *drawFigureRegions(PIX *background, const std::vector<Figure> &figures) {
-  BOXA *imageBoxes = boxaCreate((int)figures.size());
-  BOXA *captionBoxes = boxaCreate((int)figures.size());
-  BOXA *boundingBoxes = boxaCreate((int)figures.size());
-  for (Figure figure : figures) {
+  BoxaPtr imageBoxes(boxaCreate((int)figures.size()));
+  BoxaPtr captionBoxes(boxaCreate((int)figures.size()));
+  BoxaPtr boundingBoxes(boxaCreate((int)figures.size()));
+  for (const Figure &figure : figures) {
     BOX *captionBox = figure.captionBB;
     if (captionBox != NULL)
-      boxaAddBox(captionBoxes, captionBox, L_CLONE);
+      boxaAddBox(captionBoxes.get(), captionBox, L_CLONE);
     BOX *imageBox = figure.imageBB;
     if (imageBox != NULL)
-      boxaAddBox(imageBoxes, imageBox, L_CLONE);
+      boxaAddBox(imageBoxes.get(), imageBox, L_CLONE);
 
     if (imageBox != NULL and captionBox != NULL) {
       BOX *boundingBox = boxBoundingRegion(captionBox, imageBox);
@@ -255,153 +797,277 @@ PIX *drawFigureRegions(PIX *background, const std::vector<Figure> &figures) {
       boundingBox->h += pad * 2;
       boundingBox->x -= pad;
       boundingBox->y -= pad;
-      boxaAddBox(boundingBoxes, boundingBox, L_CLONE);
+      boxaAddBox(boundingBoxes.get(), boundingBox, L_INSERT);
     }
   }
-  PIX *scratch = pixCopy(NULL, background); // TODO leaks memory
-  PIX *output;
+  PixPtr output(pixCopy(NULL, background));
   if (imageBoxes->n > 0)
-    scratch = pixDrawBoxa(background, imageBoxes, 4, 0x00ff0000);
+    output.reset(pixDrawBoxa(output.get(), imageBoxes.get(), 4, 0x00ff0000));
   if (captionBoxes->n > 0)
-    scratch = pixDrawBoxa(scratch, captionBoxes, 4, 0x0000ff00);
-  if (boundingBoxes->n > 0) {
-    output = pixDrawBoxa(scratch, boundingBoxes, 4, 0xff000000);
-    pixDestroy(&scratch);
-  } else {
-    output = scratch;
-  }
-  boxaDestroy(&boundingBoxes);
-  boxaDestroy(&imageBoxes);
-  boxaDestroy(&captionBoxes);
-  return output;
+    output.reset(pixDrawBoxa(output.get(), captionBoxes.get(), 4, 0x0000ff00));
+  if (boundingBoxes->n > 0)
+    output.reset(
+        pixDrawBoxa(output.get(), boundingBoxes.get(), 4, 0xff000000));
+  return output.release();
 }
 
-GooString *jsonSanitizeUTF8(GooString *str) {
-  int j = 0;
-  str = str->copy();
-  while (j < str->getLength()) {
-    char c = str->getChar(j);
-    if (c < 0 or c > 127) {
-      // For multi-byte encoding, skip over extra trailling bytes
-      int leadingOne = 2;
-      while ((c >> (8 - leadingOne) & 1) == 1) {
-        ++j;
-        ++leadingOne;
-      }
-    } else if (c == '\\' or c == '\"') {
-      str->insert(j, '\\');
-      ++j;
-    } else if (c == '\n' or c <= 31) {
-      // Replace controls sequence and new lines with spaces
-      str->setChar(j, ' ');
-    }
-    ++j;
-  }
-  return str;
-}
-
-void writeText(TextPage *page, BOX *bb, const char *name,
-               std::ostream &output) {
-  output << "\"" << name << "\" : [";
-  TextWordList *words = page->makeWordList(gFalse);
-  bool firstWord = true;
-  for (int j = 0; j < words->getLength(); ++j) {
-    TextWord *word = words->get(j);
-    double x, y, x2, y2;
-    word->getBBox(&x, &y, &x2, &y2);
-    int contains;
-    BOX wordBox = BOX{(int)(x + 0.5), (int)(y + 0.5), (int)(x2 - x + 0.5),
-                      (int)(y2 - y + 0.5)};
-    boxContains(bb, &wordBox, &contains);
-    if (contains) {
-      if (word->getText()->getLength() == 0)
-        continue;
-      if (not firstWord) {
-        output << ",\n\t";
-      } else {
-        output << "\n\t";
-      }
-      GooString *str = jsonSanitizeUTF8(word->getText());
-      output << "{\"Rotation\": " << word->getRotation() << ",\"TextBB\": [";
-      output << x << "," << y << "," << x2 << "," << y2 << "], \"Text\": \"";
-      output << str->getCString() << "\"}";
-      delete str;
-      firstWord = false;
+std::string getFigureImageName(const std::string &prefix, Figure &fig,
+                               bool color, const ImageFormat &format,
+                               int thumbnail) {
+  std::string name = prefix + "-" + getFigureTypeString(fig.type) +
+                     (color ? "-c" : "-") + std::to_string(fig.number);
+  if (thumbnail > 0)
+    name += "-" + std::to_string(thumbnail);
+  return name + format.getExtension();
+}
+
+namespace {
+
+// Queues crop and its thumbnails to be saved by writer, takes ownership of
+// crop. Each thumbnail is scaled down from the next larger one rather than
+// from crop, so only the first reduction works on the full resolution image.
+void saveFigureImage(PIX *crop, const std::string &prefix, Figure &fig,
+                     bool color, const ImageFormat &format,
+                     const std::vector<int> &thumbnails, OutputWriter &writer,
+                     std::vector<std::string> &written) {
+  // Everything is scaled before anything is queued, since the writer
+  // destroys images as soon as they are written
+  std::vector<PIX *> scaled = std::vector<PIX *>();
+  PIX *source = crop;
+  for (int size : thumbnails) {
+    int longEdge = std::max(source->w, source->h);
+    PIX *thumbnail;
+    if (longEdge <= size) {
+      thumbnail = pixCopy(NULL, source);
+    } else {
+      float scale = (float)size / longEdge;
+      thumbnail = pixScaleAreaMap(source, scale, scale);
+      if (thumbnail == NULL)
+        thumbnail = pixScale(source, scale, scale);
     }
+    if (thumbnail == NULL)
+      break;
+    scaled.push_back(thumbnail);
+    source = thumbnail;
+  }
+
+  std::string name = getFigureImageName(prefix, fig, color, format, 0);
+  writer.writeImage(name, crop, format);
+  written.push_back(name);
+  for (size_t i = 0; i < scaled.size(); ++i) {
+    name = getFigureImageName(prefix, fig, color, format, thumbnails[i]);
+    writer.writeImage(name, scaled[i], format);
+    written.push_back(name);
   }
-  output << "\n]";
-  delete words;
 }
 
-void saveFiguresImage(std::vector<Figure> &figures, PIX *original,
-                      std::string prefix) {
+} // end namespace
+
+std::vector<std::string> saveFiguresImage(std::vector<Figure> &figures,
+                                          PIX *original, std::string prefix,
+                                          const ImageFormat &format,
+                                          const std::vector<int> &thumbnails,
+                                          OutputWriter &writer) {
+  std::vector<std::string> written = std::vector<std::string>();
   for (Figure fig : figures) {
-    std::string name = prefix + "-" + getFigureTypeString(fig.type) + "-" +
-                       std::to_string(fig.number) + ".png";
     if (fig.imageBB != NULL) {
-      pixWrite(name.c_str(), pixClipRectangle(original, fig.imageBB, NULL),
-               IFF_PNG);
+      saveFigureImage(pixClipRectangle(original, fig.imageBB, NULL), prefix,
+                      fig, false, format, thumbnails, writer, written);
     }
   }
+  return written;
 }
 
-void saveFiguresFullColorImage(std::vector<Figure> &figures, PIX *original,
-                      std::string prefix, int multidpi) {
+std::vector<std::string>
+saveFiguresFullColorImage(std::vector<Figure> &figures, PIX *original,
+                          std::string prefix, int multidpi,
+                          const ImageFormat &format,
+                          const std::vector<int> &thumbnails,
+                          OutputWriter &writer) {
+  std::vector<std::string> written = std::vector<std::string>();
   for (Figure fig : figures) {
-    std::string name = prefix + "-" + getFigureTypeString(fig.type) + "-c" +
-                       std::to_string(fig.number) + ".png";
     if (fig.imageBB != NULL) {
+      BOX *scaled = boxCreate(fig.imageBB->x * multidpi,
+                              fig.imageBB->y * multidpi,
+                              fig.imageBB->w * multidpi,
+                              fig.imageBB->h * multidpi);
+      saveFigureImage(pixClipRectangle(original, scaled, NULL), prefix, fig,
+                      true, format, thumbnails, writer, written);
+      boxDestroy(&scaled);
+    }
+  }
+  return written;
+}
+
+std::vector<std::string>
+saveFiguresNativeImage(std::vector<Figure> &figures,
+                       std::vector<NativeImage> &images, std::string prefix,
+                       const ImageFormat &format,
+                       const std::vector<int> &thumbnails,
+                       OutputWriter &writer) {
+  std::vector<std::string> written = std::vector<std::string>();
+  ImageFormat jpeg = ImageFormat();
+  jpeg.format = IFF_JFIF_JPEG;
+  for (size_t i = 0; i < figures.size(); ++i) {
+    if (images[i].jpeg.length() != 0) {
+      std::string name = getFigureImageName(prefix, figures[i], true, jpeg, 0);
+      writer.writeEncodedImage(name, images[i].jpeg);
+      written.push_back(name);
+    } else if (images[i].pix != NULL) {
+      saveFigureImage(images[i].pix, prefix, figures[i], true, format,
+                      thumbnails, writer, written);
+      images[i].pix = NULL;
+    }
+  }
+  return written;
+}
+
+std::vector<std::string> saveFiguresVector(PDFDoc *doc, int page, double dpi,
+                                           std::vector<Figure> &figures,
+                                           std::string prefix) {
+  PROFILE_SCOPE("vector");
+  std::vector<std::string> written = std::vector<std::string>();
+  if (std::none_of(figures.begin(), figures.end(),
+                   [](Figure &fig) { return fig.imageBB != NULL; }))
+    return written;
+
+  // The page is copied once, then each figure is an incremental update of
+  // the copy that only replaces the page's crop box
+  std::string pageName = prefix + "-page-" + std::to_string(page) + ".tmp.pdf";
+  GooString pageFile(pageName.c_str());
+  if (doc->savePageAs(&pageFile, page) != errNone) {
+    unlink(pageName.c_str());
+    return written;
+  }
 
-      fig.imageBB->x *= multidpi;
-      fig.imageBB->y *= multidpi;
-      fig.imageBB->w *= multidpi;
-      fig.imageBB->h *= multidpi;
+  // Figures are in the device space of a render of the media box, the
+  // inverse of that transform takes them back to the page's user space
+  GfxState state(dpi, dpi, doc->getPage(page)->getMediaBox(),
+                 doc->getPageRotate(page), gTrue);
+  double *ctm = state.getCTM();
+  double det = ctm[0] * ctm[3] - ctm[1] * ctm[2];
 
-      pixWrite(name.c_str(), pixClipRectangle(original, fig.imageBB, NULL),
-               IFF_PNG);
+  PDFDoc *single = new PDFDoc(new GooString(pageName.c_str()));
+  if (single->isOk()) {
+    XRef *xref = single->getXRef();
+    Ref ref = single->getCatalog()->getPage(1)->getRef();
+    for (Figure &fig : figures) {
+      if (fig.imageBB == NULL)
+        continue;
+      BOX *bb = fig.imageBB;
+      double xs[2] = {(double)bb->x, (double)bb->x + bb->w};
+      double ys[2] = {(double)bb->y, (double)bb->y + bb->h};
+      double xMin = 0, yMin = 0, xMax = 0, yMax = 0;
+      for (int i = 0; i < 4; ++i) {
+        double x = xs[i % 2] - ctm[4];
+        double y = ys[i / 2] - ctm[5];
+        double ux = (ctm[3] * x - ctm[2] * y) / det;
+        double uy = (ctm[0] * y - ctm[1] * x) / det;
+        xMin = i == 0 ? ux : std::min(xMin, ux);
+        xMax = i == 0 ? ux : std::max(xMax, ux);
+        yMin = i == 0 ? uy : std::min(yMin, uy);
+        yMax = i == 0 ? uy : std::max(yMax, uy);
+      }
+
+      Object pageObj;
+      xref->fetch(ref.num, ref.gen, &pageObj);
+      if (not pageObj.isDict()) {
+        pageObj.free();
+        break;
+      }
+      Object cropBox, value;
+      cropBox.initArray(xref);
+      cropBox.arrayAdd(value.initReal(xMin));
+      cropBox.arrayAdd(value.initReal(yMin));
+      cropBox.arrayAdd(value.initReal(xMax));
+      cropBox.arrayAdd(value.initReal(yMax));
+      pageObj.dictSet("CropBox", &cropBox);
+      xref->setModifiedObject(&pageObj, ref);
+      pageObj.free();
 
-      fig.imageBB->x /= multidpi;
-      fig.imageBB->y /= multidpi;
-      fig.imageBB->w /= multidpi;
-      fig.imageBB->h /= multidpi;
+      std::string name = prefix + "-" + getFigureTypeString(fig.type) + "-" +
+                         std::to_string(fig.number) + ".pdf";
+      GooString figureFile(name.c_str());
+      if (single->saveAs(&figureFile, writeForceIncremental) == errNone)
+        written.push_back(name);
     }
   }
+  delete single;
+  unlink(pageName.c_str());
+  return written;
 }
 
-void writeFigureJSON(Figure &fig, int width, int height, double dpi,
-                     std::vector<TextPage *> &text, std::ostream &output) {
-  output << "{\"Type\":\"" << getFigureTypeString(fig.type) << "\",\n";
-  output << "\"Number\": " << fig.number << ",\n";
-  output << "\"Page\": " << (fig.page + 1) << ",\n"; // Switch from 0 indexing
-  output << "\"DPI\": " << dpi << ",\n";
-  output << "\"Width\": " << width << ",\n";
-  output << "\"Height\": " << height << ",\n";
+FigureRecordBuilder::FigureRecordBuilder(std::vector<TextPage *> &text,
+                                         double dpi)
+    : text(text), dpi(dpi), wordsPage(-1), words(std::vector<WordRecord>()),
+      wordBoxes(std::vector<BOX>()) {}
 
+void FigureRecordBuilder::loadWords(int page) {
+  wordsPage = page;
+  words.clear();
+  wordBoxes.clear();
+  TextWordList *wordList = text.at(page)->makeWordList(gFalse);
+  for (int j = 0; j < wordList->getLength(); ++j) {
+    TextWord *word = wordList->get(j);
+    WordRecord record;
+    word->getBBox(&record.bb[0], &record.bb[1], &record.bb[2], &record.bb[3]);
+    record.rotation = word->getRotation();
+    record.text = std::string(word->getText()->getCString(),
+                              word->getText()->getLength());
+    double x = record.bb[0], y = record.bb[1];
+    wordBoxes.push_back(BOX{(int)(x + 0.5), (int)(y + 0.5),
+                            (int)(record.bb[2] - x + 0.5),
+                            (int)(record.bb[3] - y + 0.5)});
+    words.push_back(record);
+  }
+  delete wordList;
+}
+
+void FigureRecordBuilder::build(Figure &fig, int width, int height,
+                                FigureRecord &record) {
+  PROFILE_SCOPE("records");
+  record.type = getFigureTypeString(fig.type);
+  record.number = fig.number;
+  record.page = fig.page + 1; // Switch from 0 indexing
+  record.dpi = dpi;
+  record.width = width;
+  record.height = height;
   TextPage *page = fig.page == -1 ? NULL : text.at(fig.page);
-  if (fig.captionBB == NULL) {
-    output << "\"CaptionBB\": null,\n";
-    output << "\"Caption\": null,\n";
-  } else {
-    output << "\"CaptionBB\": [" << fig.captionBB->x << "," << fig.captionBB->y;
-    output << "," << fig.captionBB->x + fig.captionBB->w << ",";
-    output << fig.captionBB->y + fig.captionBB->h << "],\n";
+  record.hasCaption = fig.captionBB != NULL;
+  if (record.hasCaption) {
     BOX *bb = fig.captionBB;
-    GooString *caption = jsonSanitizeUTF8(
-        page->getText(bb->x, bb->y, bb->x + bb->w, bb->y + bb->h));
-    output << "\"Caption\": \"" << caption->getCString() << "\",\n";
-    delete caption;
-  }
-  if (fig.imageBB == NULL) {
-    output << "\"ImageBB\": null,\n";
-    output << "\"ImageText\" : null\n";
-    output << "}\n";
-  } else {
-    output << "\"ImageBB\": [" << fig.imageBB->x << "," << fig.imageBB->y;
-    output << "," << fig.imageBB->x + fig.imageBB->w << ","
-           << fig.imageBB->y + fig.imageBB->h;
-    output << "],\n";
+    int captionBB[4] = {bb->x, bb->y, bb->x + bb->w, bb->y + bb->h};
+    std::copy(captionBB, captionBB + 4, record.captionBB);
+    // Caption text is built by poppler since it joins lines and hyphens
+    // differently than the plain word list
+    record.caption = "";
+    if (page != NULL) {
+      GooString *caption =
+          page->getText(bb->x, bb->y, bb->x + bb->w, bb->y + bb->h);
+      record.caption =
+          std::string(caption->getCString(), caption->getLength());
+      delete caption;
+    }
+  }
+  record.hasImage = fig.imageBB != NULL;
+  record.imageText.clear();
+  record.images.clear();
+  if (record.hasImage) {
     BOX *bb = fig.imageBB;
-    writeText(page, bb, "ImageText", output);
-    output << "}";
+    int imageBB[4] = {bb->x, bb->y, bb->x + bb->w, bb->y + bb->h};
+    std::copy(imageBB, imageBB + 4, record.imageBB);
+    if (page != NULL and wordsPage != fig.page) {
+      loadWords(fig.page);
+    } else if (page == NULL) {
+      wordsPage = -1;
+      words.clear();
+      wordBoxes.clear();
+    }
+    for (size_t i = 0; i < words.size(); ++i) {
+      int contains;
+      boxContains(bb, &wordBoxes[i], &contains);
+      if (contains and words[i].text.length() != 0)
+        record.imageText.push_back(words[i]);
+    }
   }
 }
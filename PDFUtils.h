@@ -6,11 +6,18 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <map>
+#include <set>
+#include <cstdint>
 
 #include <TextOutputDev.h>
 
 #include <leptonica/allheaders.h>
 
+#include "FigureRecord.h"
+#include "OutputWriter.h"
+#include "LeptHandles.h"
+
 enum FigureType { FIGURE, TABLE };
 
 const char *getFigureTypeString(FigureType type);
@@ -27,12 +34,25 @@ public:
   TextWord *word;
 };
 
+/*
+  Captions and figures own a reference to each of their boxes. Copies share
+  the boxes through leptonica's reference counts, so a box outlives the page
+  it was found on for as long as any copy holds it.
+**/
 class Caption {
 public:
+  // Takes ownership of boundingBox
   Caption(CaptionStart captionStart, BOX *boundingBox);
 
+  // Takes ownership of boundingBox
   Caption(int page, int number, FigureType type, BOX *boundingBox);
 
+  Caption(const Caption &other);
+
+  Caption &operator=(const Caption &other);
+
+  ~Caption();
+
   int page;
   int number;
   FigureType type;
@@ -41,10 +61,17 @@ public:
 
 class Figure {
 public:
+  // Takes ownership of imageBB, which can be NULL
   Figure(Caption caption, BOX *imageBB);
 
   Figure(CaptionStart captionStart);
 
+  Figure(const Figure &other);
+
+  Figure &operator=(const Figure &other);
+
+  ~Figure();
+
   FigureType type;
   int page;
   int number;
@@ -52,6 +79,35 @@ public:
   BOX *captionBB;
 };
 
+// Saves figures so they can be read back with readFigures
+void writeFigures(const std::vector<Figure> &figures, std::ostream &output);
+
+// Appends figures saved by writeFigures, returns false on malformed input
+bool readFigures(std::istream &input, std::vector<Figure> &figures);
+
+/*
+  Computes fingerprints of pages from the page dictionary (content streams,
+  resources, annotations and page boxes, including inherited ones) so pages
+  that are unchanged between revisions of a document can be recognized. Streams
+  are hashed without decoding them. Objects shared between pages, such as
+  fonts, are only hashed once per document.
+**/
+class PageFingerprinter {
+public:
+  PageFingerprinter(PDFDoc *doc);
+
+  uint64_t getFingerprint(int page);
+
+private:
+  uint64_t hashObject(Object *obj, uint64_t hash);
+
+  uint64_t hashDict(Dict *dict, uint64_t hash, const char *skipKey);
+
+  PDFDoc *doc;
+  std::map<std::pair<int, int>, uint64_t> refHashes;
+  std::set<std::pair<int, int>> inProgress;
+};
+
 // Draws a box on a pix, and displays is. Useful for debugging.
 void displayBox(PIX *pix, BOX *box);
 
@@ -63,14 +119,55 @@ void displayBox(PIX *pix, BOX *box);
 **/
 bool isFilledByImage(PDFDoc *doc, int page);
 
+class SplashBitmap;
+
+// Converts a splashModeMono8 bitmap to an 8 bpp PIX, returns NULL for bitmaps
+// in other modes. The caller owns the returned PIX.
+PIX *bitmapToPix(SplashBitmap *bitmap);
+
+// As bitmapToPix for splashModeRGB8 bitmaps, gives a 32 bpp PIX
+PIX *fullColorBitmapToPix(SplashBitmap *bitmap);
+
 // Gets a PIX of the given page rendered at the given dpi.
-std::unique_ptr<PIX> getFullRenderPix(PDFDoc *doc, int page, double dpi);
+PixPtr getFullRenderPix(PDFDoc *doc, int page, double dpi);
 
 // Gets a PIX of the given page rendered wthout text at the given dpi.
-std::unique_ptr<PIX> getGraphicOnlyPix(PDFDoc *doc, int page, double dpi);
+PixPtr getGraphicOnlyPix(PDFDoc *doc, int page, double dpi);
 
 // Gets a PIX of the given page rendered at the given dpi with splashModeRGB8 color mode.
-std::unique_ptr<PIX> getFullColorRenderPix(PDFDoc *doc, int page, double dpi);
+PixPtr getFullColorRenderPix(PDFDoc *doc, int page, double dpi);
+
+/*
+  An embedded image that makes up a figure by itself. Either jpeg holds the
+  image's original JPEG stream, or pix holds the decoded image at the image's
+  own resolution. Both are empty if the figure is not a single image.
+**/
+class NativeImage {
+public:
+  NativeImage();
+
+  std::string jpeg;
+  PIX *pix;
+};
+
+// Sets images to hold, for each of figures, the embedded image that covers at
+// least 95% of the figure's region while being at most 5% larger, if there is
+// one that is drawn upright or flipped, unclipped and without a mask. When
+// passJPEG is set, DCT encoded RGB or gray images are returned as JPEG data
+// without decoding them. The caller owns the returned PIXes.
+void getNativeImages(PDFDoc *doc, int page, double dpi,
+                     std::vector<Figure> &figures, bool passJPEG,
+                     std::vector<NativeImage> &images);
+
+// Gets the bounding boxes of the non-text graphical elements of the given page
+// at the given dpi without rendering it.
+BOXA *getGraphicBoxes(PDFDoc *doc, int page, double dpi);
+
+// Gets the size in pixels of the given page rendered at the given dpi.
+void getPageSize(PDFDoc *doc, int page, double dpi, int *width, int *height);
+
+// Gets the TextPage* object of a single page at a given dpi.
+TextPage *getTextPage(PDFDoc *doc, int page, double dpi);
 
 // Gets the TextPage* objects of a document at a given dpi.
 std::vector<TextPage *> getTextPages(PDFDoc *doc, double dpi);
@@ -78,19 +175,69 @@ std::vector<TextPage *> getTextPages(PDFDoc *doc, double dpi);
 // Get a PIX with the given figures drawn on it
 PIX *drawFigureRegions(PIX *background, const std::vector<Figure> &figures);
 
-// Return a new GooString with new lines and control characters removed and
-// with JSON illegal characters escaped.
-GooString *jsonSanitizeUTF8(GooString *str);
+// Name of the image saved for fig, color is true for full color images and
+// thumbnail is the size of a thumbnail or 0 for the full image
+std::string getFigureImageName(const std::string &prefix, Figure &fig,
+                               bool color, const ImageFormat &format,
+                               int thumbnail);
+
+// Queues figures cropped from original to be saved by writer in the given
+// format, returns the names of the files that will be written. For each size
+// in thumbnails, which must be in decreasing order, a copy scaled so its
+// longest side is at most that many pixels is saved as well.
+std::vector<std::string> saveFiguresImage(std::vector<Figure> &figures,
+                                          PIX *original, std::string prefix,
+                                          const ImageFormat &format,
+                                          const std::vector<int> &thumbnails,
+                                          OutputWriter &writer);
+
+std::vector<std::string>
+saveFiguresFullColorImage(std::vector<Figure> &figures, PIX *original,
+                          std::string prefix, int multidpi,
+                          const ImageFormat &format,
+                          const std::vector<int> &thumbnails,
+                          OutputWriter &writer);
+
+// Queues the images found by getNativeImages to be saved by writer, named like
+// the images saveFiguresFullColorImage writes. JPEG data is saved as is with
+// a .jpg extension, decoded images are saved in the given format. Takes
+// ownership of the PIXes in images. Returns the names of the files that will
+// be written.
+std::vector<std::string>
+saveFiguresNativeImage(std::vector<Figure> &figures,
+                       std::vector<NativeImage> &images, std::string prefix,
+                       const ImageFormat &format,
+                       const std::vector<int> &thumbnails,
+                       OutputWriter &writer);
+
+// Saves each figure found on page of doc at the given dpi as a single page PDF
+// named prefix-<Type>-<Number>.pdf. The page's content and resources are kept
+// as they are, only the crop box is set to the figure's region, so figures
+// stay vector graphics and nothing is rendered. Returns the names of the files
+// written.
+std::vector<std::string> saveFiguresVector(PDFDoc *doc, int page, double dpi,
+                                           std::vector<Figure> &figures,
+                                           std::string prefix);
 
-void writeText(TextPage *page, BOX *bb, const char *name, std::ostream &output);
+/*
+  Builds the FigureRecords that are written out for figures. The words of a
+  page are collected once and shared by all the figures on that page, so
+  figures should be built grouped by page.
+**/
+class FigureRecordBuilder {
+public:
+  FigureRecordBuilder(std::vector<TextPage *> &text, double dpi);
 
-void saveFiguresImage(std::vector<Figure> &figures, PIX *original,
-                      std::string prefix);
+  void build(Figure &fig, int width, int height, FigureRecord &record);
 
-void saveFiguresFullColorImage(std::vector<Figure> &figures, PIX *original,
-                      std::string prefix, int multidpi);
+private:
+  void loadWords(int page);
 
-void writeFigureJSON(Figure &figures, int height, int width, double dpi,
-                     std::vector<TextPage *> &text, std::ostream &output);
+  std::vector<TextPage *> &text;
+  double dpi;
+  int wordsPage;
+  std::vector<WordRecord> words;
+  std::vector<BOX> wordBoxes;
+};
 
 #endif /* defined(__figureextractor__PDFUtils__) */
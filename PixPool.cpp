@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <leptonica/allheaders.h>
+
+#include "PixPool.h"
+
+namespace {
+
+// Buffers start with a header holding their size class, or 0 for buffers
+// that are not pooled, so they can be returned to the right free list. The
+// header is padded to 16 bytes to keep the data aligned.
+const size_t poolHeaderSize = 16;
+
+void *poolAllocate(size_t size) { return getPixPool().allocate(size); }
+
+void poolRelease(void *data) { getPixPool().release(data); }
+
+} // end namespace
+
+PixPool::Stats::Stats()
+    : allocations(0), hits(0), unpooled(0), dropped(0), cachedBytes(0),
+      peakCachedBytes(0) {}
+
+PixPool::PixPool()
+    : enabled(false), used(false), maxCached(0),
+      freeLists(std::map<size_t, std::vector<char *>>()), stats(Stats()) {}
+
+PixPool::~PixPool() {
+  for (auto &list : freeLists) {
+    for (char *block : list.second)
+      free(block);
+  }
+}
+
+bool PixPool::enable(size_t maxCached) {
+  if (used)
+    return false;
+  this->maxCached = maxCached;
+  enabled = true;
+  setPixMemoryManager(poolAllocate, poolRelease);
+  return true;
+}
+
+size_t PixPool::getSizeClass(size_t size) {
+  size_t power = 1;
+  while (power <= size / 2)
+    power *= 2;
+  size_t step = power / 8;
+  return (size + step - 1) / step * step;
+}
+
+void *PixPool::allocate(size_t size) {
+  if (not used)
+    used = true;
+  if (not enabled)
+    return malloc(size);
+  size_t sizeClass = size < minPooledSize ? 0 : getSizeClass(size);
+  char *block = NULL;
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    if (sizeClass == 0) {
+      stats.unpooled += 1;
+    } else {
+      stats.allocations += 1;
+      std::map<size_t, std::vector<char *>>::iterator list =
+          freeLists.find(sizeClass);
+      if (list != freeLists.end() and list->second.size() != 0) {
+        block = list->second.back();
+        list->second.pop_back();
+        stats.hits += 1;
+        stats.cachedBytes -= sizeClass;
+      }
+    }
+  }
+  if (block == NULL) {
+    block = (char *)malloc((sizeClass == 0 ? size : sizeClass) +
+                           poolHeaderSize);
+    if (block == NULL)
+      return NULL;
+    uint64_t header = sizeClass;
+    memcpy(block, &header, sizeof(header));
+  }
+  return block + poolHeaderSize;
+}
+
+void PixPool::release(void *data) {
+  if (data == NULL)
+    return;
+  if (not enabled) {
+    free(data);
+    return;
+  }
+  char *block = (char *)data - poolHeaderSize;
+  uint64_t header;
+  memcpy(&header, block, sizeof(header));
+  size_t sizeClass = header;
+  if (sizeClass != 0) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (stats.cachedBytes + sizeClass <= maxCached) {
+      freeLists[sizeClass].push_back(block);
+      stats.cachedBytes += sizeClass;
+      stats.peakCachedBytes =
+          std::max(stats.peakCachedBytes, stats.cachedBytes);
+      return;
+    }
+    stats.dropped += 1;
+  }
+  free(block);
+}
+
+PixPool::Stats PixPool::getStats() {
+  std::unique_lock<std::mutex> guard(lock);
+  return stats;
+}
+
+void PixPool::writeJSON(std::ostream &output) {
+  Stats current = getStats();
+  double hitRate =
+      current.allocations == 0 ? 0 : current.hits / (double)current.allocations;
+  output << "{\"Allocations\": " << current.allocations
+         << ", \"Hits\": " << current.hits << ", \"HitRate\": " << hitRate
+         << ", \"Unpooled\": " << current.unpooled
+         << ", \"Dropped\": " << current.dropped
+         << ", \"CachedBytes\": " << current.cachedBytes
+         << ", \"PeakCachedBytes\": " << current.peakCachedBytes << "}";
+}
+
+PixPool &getPixPool() {
+  static PixPool pool;
+  return pool;
+}
@@ -0,0 +1,82 @@
+#ifndef __figureextractor__PixPool__
+#define __figureextractor__PixPool__
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <iostream>
+
+/**
+  Recycles the data buffers of PIXes. Every page allocates several page sized
+  images (renders, thresholded copies, masks and templates), which the system
+  allocator maps and unmaps each time since they are large. Once enabled,
+  leptonica allocates PIX data through the pool and freed buffers are kept in
+  free lists by size class, so the next page's images of the same size reuse
+  them.
+
+  Sizes are rounded up to classes that are 1/8th of a power of two apart, so
+  at most 12.5% of a buffer is wasted. Buffers smaller than minPooledSize go
+  straight to malloc. At most maxCached bytes of free buffers are kept, once
+  that is reached freed buffers are released to the system.
+ */
+class PixPool {
+public:
+  class Stats {
+  public:
+    Stats();
+
+    // Allocations large enough to be pooled, and how many reused a buffer
+    long allocations;
+    long hits;
+    // Allocations passed to malloc because they were small
+    long unpooled;
+    // Freed buffers that were released because the pool was full
+    long dropped;
+    size_t cachedBytes;
+    size_t peakCachedBytes;
+  };
+
+  static const size_t minPooledSize = 64 * 1024;
+
+  PixPool();
+
+  // Frees the cached buffers, so leak checkers only report real leaks
+  ~PixPool();
+
+  // Installs the pool as leptonica's PIX allocator. Must be called before any
+  // PIX is created and before other threads are started, release() assumes
+  // every buffer it is given came from the pool. Returns false, and leaves
+  // the pool disabled, if allocate() has already been called.
+  bool enable(size_t maxCached);
+
+  bool isEnabled() { return enabled; }
+
+  // Allocates from the pool, or with malloc if the pool is not enabled
+  void *allocate(size_t size);
+
+  // Frees data returned by allocate()
+  void release(void *data);
+
+  Stats getStats();
+
+  // Writes the stats as a JSON object
+  void writeJSON(std::ostream &output);
+
+private:
+  static size_t getSizeClass(size_t size);
+
+  bool enabled;
+  // Set by the first allocate(), the pool can no longer be enabled
+  std::atomic<bool> used;
+  size_t maxCached;
+  std::mutex lock;
+  // Free buffers by size class, buffers include their header
+  std::map<size_t, std::vector<char *>> freeLists;
+  Stats stats;
+};
+
+PixPool &getPixPool();
+
+#endif /* defined(__figureextractor__PixPool__) */
@@ -0,0 +1,401 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <leptonica/allheaders.h>
+
+#include "Profiler.h"
+#include "FigureRecord.h"
+#include "PixPool.h"
+
+namespace {
+
+thread_local int currentPage = -1;
+
+std::atomic<int> nextThread(0);
+
+// Small ids are easier to read in trace viewers than pthread ids
+int getThreadId() {
+  thread_local int id = nextThread++;
+  return id;
+}
+
+// PIX data is allocated with a header holding its size, so frees can be
+// counted too. Allocations go on to the PIX pool, which is malloc unless it
+// is enabled. The header is padded to 16 bytes to keep the data aligned.
+const size_t pixHeaderSize = 16;
+
+std::atomic<long> pixLive(0);
+std::atomic<long> pixPeak(0);
+thread_local long pixAllocated = 0;
+thread_local long pixFreed = 0;
+
+void *allocPix(size_t size) {
+  char *block = (char *)getPixPool().allocate(size + pixHeaderSize);
+  if (block == NULL)
+    return NULL;
+  uint64_t header = size;
+  memcpy(block, &header, sizeof(header));
+  pixAllocated += size;
+  long live = pixLive += size;
+  long peak = pixPeak.load();
+  while (live > peak and not pixPeak.compare_exchange_weak(peak, live)) {
+  }
+  return block + pixHeaderSize;
+}
+
+void freePix(void *data) {
+  if (data == NULL)
+    return;
+  // enableMemory() is called before any PIX is created, so all PIX data has
+  // the header
+  char *block = (char *)data - pixHeaderSize;
+  uint64_t header;
+  memcpy(&header, block, sizeof(header));
+  pixFreed += header;
+  pixLive -= header;
+  getPixPool().release(block);
+}
+
+double toSeconds(const timespec &t) { return t.tv_sec + t.tv_nsec * 1e-9; }
+
+double getProcessCPUTime() {
+  timespec t;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+  return toSeconds(t);
+}
+
+} // end namespace
+
+Profiler::Profiler()
+    : enabled(false), tracing(false), memory(false), document(""),
+      startWall(0), startCPU(0), times(std::map<int, StageTimes>()),
+      counts(std::map<int, Counts>()), events(std::vector<Event>()),
+      threadNames(std::map<int, std::string>()),
+      stageMemory(std::map<int, StageMemories>()),
+      pageMemory(std::map<int, PageMemory>()) {}
+
+void Profiler::enable() {
+  enabled = true;
+  startWall = getWallTime();
+  startCPU = getProcessCPUTime();
+}
+
+void Profiler::enableTrace(const std::string &document) {
+  this->document = document;
+  tracing = true;
+  enable();
+}
+
+void Profiler::enableMemory() {
+  setPixMemoryManager(allocPix, freePix);
+  memory = true;
+  enable();
+}
+
+void Profiler::setThreadName(const char *name) {
+  if (not tracing)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  threadNames[getThreadId()] = name;
+}
+
+void Profiler::setPage(int page) {
+  if (memory and page != currentPage) {
+    std::unique_lock<std::mutex> guard(lock);
+    long rss = getRSS();
+    long peakRSS = getPeakRSS();
+    long live = pixLive.load();
+    if (currentPage >= 0) {
+      PageMemory &done = pageMemory[currentPage];
+      done.rssEnd = rss;
+      done.peakRSSEnd = peakRSS;
+      done.pixEnd = live;
+      done.pixPeak = pixPeak.load();
+    }
+    if (page >= 0) {
+      pageMemory[page] =
+          PageMemory{rss, rss, peakRSS, peakRSS, live, live, live};
+      pixPeak = live;
+    }
+  }
+  currentPage = page;
+}
+
+int Profiler::getPage() { return currentPage; }
+
+void Profiler::addTime(const char *stage, double wall, double cpu) {
+  if (not enabled)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  StageTimes &stages = times[currentPage];
+  StageTimes::iterator time = stages.find(stage);
+  if (time == stages.end())
+    time = stages.insert(std::make_pair(stage, StageTime{0, 0, 0})).first;
+  time->second.wall += wall;
+  time->second.cpu += cpu;
+  time->second.calls += 1;
+}
+
+void Profiler::addCount(const char *counter, long n) {
+  if (not enabled)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  counts[currentPage][counter] += n;
+}
+
+void Profiler::addEvent(const char *name, double start, double end) {
+  if (not tracing)
+    return;
+  int thread = getThreadId();
+  std::unique_lock<std::mutex> guard(lock);
+  events.push_back(Event{name, currentPage, thread, start, end});
+}
+
+void Profiler::addMemory(const char *stage, long pixAllocated,
+                         long pixFreed, long rssGrowth) {
+  if (not memory)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  StageMemories &stages = stageMemory[currentPage];
+  StageMemories::iterator used = stages.find(stage);
+  if (used == stages.end())
+    used = stages.insert(std::make_pair(stage, StageMemory{0, 0, 0})).first;
+  used->second.pixAllocated += pixAllocated;
+  used->second.pixFreed += pixFreed;
+  used->second.rssGrowth += rssGrowth;
+}
+
+long Profiler::getRSS() {
+  long pages = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm != NULL) {
+    if (fscanf(statm, "%*d %ld", &pages) != 1)
+      pages = 0;
+    fclose(statm);
+  }
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+long Profiler::getPeakRSS() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return usage.ru_maxrss * 1024L;
+}
+
+void Profiler::getPixBytes(long *allocated, long *freed) {
+  *allocated = pixAllocated;
+  *freed = pixFreed;
+}
+
+double Profiler::getWallTime() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return toSeconds(t);
+}
+
+double Profiler::getThreadCPUTime() {
+  timespec t;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+  return toSeconds(t);
+}
+
+void Profiler::writeStages(const StageTimes &stages, const Counts &counters,
+                           std::ostream &output) {
+  output << "\"Stages\": {";
+  bool first = true;
+  for (const auto &stage : stages) {
+    output << (first ? "" : ",") << "\n  \"" << stage.first
+           << "\": {\"Wall\": " << stage.second.wall
+           << ", \"CPU\": " << stage.second.cpu
+           << ", \"Calls\": " << stage.second.calls << "}";
+    first = false;
+  }
+  output << "},\n\"Counters\": {";
+  first = true;
+  for (const auto &counter : counters) {
+    output << (first ? "" : ", ") << "\"" << counter.first
+           << "\": " << counter.second;
+    first = false;
+  }
+  output << "}";
+}
+
+void Profiler::writeJSON(std::ostream &output) {
+  std::unique_lock<std::mutex> guard(lock);
+  StageTimes totalTimes = StageTimes();
+  Counts totalCounts = Counts();
+  std::map<int, bool> pages = std::map<int, bool>();
+  for (const auto &page : times) {
+    pages[page.first] = true;
+    for (const auto &stage : page.second) {
+      StageTime &total = totalTimes[stage.first];
+      total.wall += stage.second.wall;
+      total.cpu += stage.second.cpu;
+      total.calls += stage.second.calls;
+    }
+  }
+  for (const auto &page : counts) {
+    pages[page.first] = true;
+    for (const auto &counter : page.second)
+      totalCounts[counter.first] += counter.second;
+  }
+
+  output << "{\"Wall\": " << getWallTime() - startWall
+         << ", \"CPU\": " << getProcessCPUTime() - startCPU << ",\n";
+  writeStages(totalTimes, totalCounts, output);
+  output << ",\n\"Pages\": [";
+  bool first = true;
+  for (const auto &page : pages) {
+    if (page.first < 0)
+      continue;
+    output << (first ? "" : ",") << "\n{\"Page\": " << page.first + 1
+           << ",\n";
+    writeStages(times[page.first], counts[page.first], output);
+    output << "}";
+    first = false;
+  }
+  output << "]}\n";
+}
+
+void Profiler::writeTrace(std::ostream &output) {
+  std::unique_lock<std::mutex> guard(lock);
+  int pid = getpid();
+  std::string escaped = std::string();
+  appendJSONEscaped(document.data(), document.size(), escaped);
+  char buf[64];
+  output << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  output << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+         << ", \"args\": {\"name\": \"pdffigures " << escaped << "\"}}";
+  for (const auto &thread : threadNames) {
+    output << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+           << ", \"tid\": " << thread.first << ", \"args\": {\"name\": \""
+           << thread.second << "\"}}";
+  }
+  for (const Event &event : events) {
+    // Microseconds, printed in full since they are large
+    snprintf(buf, sizeof(buf), "%.3f, \"dur\": %.3f", event.start * 1e6,
+             (event.end - event.start) * 1e6);
+    output << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": "
+           << pid << ", \"tid\": " << event.thread << ", \"ts\": " << buf
+           << ", \"args\": {";
+    if (event.page >= 0)
+      output << "\"page\": " << event.page + 1;
+    output << "}}";
+  }
+  output << "\n]}\n";
+}
+
+void Profiler::writeStageMemory(const StageMemories &stages,
+                                std::ostream &output) {
+  output << "\"Stages\": {";
+  bool first = true;
+  for (const auto &stage : stages) {
+    output << (first ? "" : ",") << "\n  \"" << stage.first
+           << "\": {\"PixAllocated\": " << stage.second.pixAllocated
+           << ", \"PixRetained\": "
+           << stage.second.pixAllocated - stage.second.pixFreed
+           << ", \"RSSGrowth\": " << stage.second.rssGrowth << "}";
+    first = false;
+  }
+  output << "}";
+}
+
+int Profiler::writeMemoryJSON(std::ostream &output) {
+  std::unique_lock<std::mutex> guard(lock);
+  StageMemories totals = StageMemories();
+  for (const auto &page : stageMemory) {
+    for (const auto &stage : page.second) {
+      StageMemory &total = totals[stage.first];
+      total.pixAllocated += stage.second.pixAllocated;
+      total.pixFreed += stage.second.pixFreed;
+      total.rssGrowth += stage.second.rssGrowth;
+    }
+  }
+
+  // Pages that leave PIX memory behind are leaking, or holding on to
+  // results, and make memory grow with the length of the document
+  std::vector<int> growing = std::vector<int>();
+  for (const auto &page : pageMemory) {
+    if (page.second.pixEnd > page.second.pixStart)
+      growing.push_back(page.first);
+  }
+
+  output << "{\"RSS\": " << getRSS() << ", \"PeakRSS\": " << getPeakRSS()
+         << ", \"PixBytes\": " << pixLive.load() << ",\n";
+  if (getPixPool().isEnabled()) {
+    output << "\"PixPool\": ";
+    getPixPool().writeJSON(output);
+    output << ",\n";
+  }
+  if (pageMemory.size() != 0) {
+    output << "\"RSSGrowth\": "
+           << pageMemory.rbegin()->second.rssEnd -
+                  pageMemory.begin()->second.rssStart
+           << ",\n";
+  }
+  output << "\"GrowingPages\": [";
+  for (size_t i = 0; i < growing.size(); ++i)
+    output << (i == 0 ? "" : ", ") << growing[i] + 1;
+  output << "],\n";
+  writeStageMemory(totals, output);
+  output << ",\n\"Pages\": [";
+  bool first = true;
+  for (const auto &page : pageMemory) {
+    const PageMemory &used = page.second;
+    output << (first ? "" : ",") << "\n{\"Page\": " << page.first + 1
+           << ", \"RSSStart\": " << used.rssStart
+           << ", \"RSSEnd\": " << used.rssEnd
+           << ", \"PeakRSS\": " << used.peakRSSEnd
+           << ", \"RaisedPeakRSS\": "
+           << (used.peakRSSEnd > used.peakRSSStart ? "true" : "false")
+           << ", \"PixStart\": " << used.pixStart
+           << ", \"PixEnd\": " << used.pixEnd
+           << ", \"PixPeak\": " << used.pixPeak << ",\n";
+    writeStageMemory(stageMemory[page.first], output);
+    output << "}";
+    first = false;
+  }
+  output << "]}\n";
+  return growing.size();
+}
+
+Profiler &getProfiler() {
+  static Profiler profiler;
+  return profiler;
+}
+
+ProfileScope::ProfileScope(const char *stage, bool isStage)
+    : stage(stage), isStage(isStage), wall(0), cpu(0), pixAllocated(0),
+      pixFreed(0), rss(0) {
+  if (getProfiler().isEnabled()) {
+    wall = Profiler::getWallTime();
+    cpu = Profiler::getThreadCPUTime();
+  }
+  if (isStage and getProfiler().isTrackingMemory()) {
+    Profiler::getPixBytes(&pixAllocated, &pixFreed);
+    rss = Profiler::getRSS();
+  }
+}
+
+ProfileScope::~ProfileScope() {
+  if (getProfiler().isEnabled()) {
+    double end = Profiler::getWallTime();
+    if (isStage)
+      getProfiler().addTime(stage, end - wall,
+                            Profiler::getThreadCPUTime() - cpu);
+    getProfiler().addEvent(stage, wall, end);
+  }
+  if (isStage and getProfiler().isTrackingMemory()) {
+    long allocated, freed;
+    Profiler::getPixBytes(&allocated, &freed);
+    getProfiler().addMemory(stage, allocated - pixAllocated,
+                            freed - pixFreed, Profiler::getRSS() - rss);
+  }
+}
@@ -0,0 +1,191 @@
+#ifndef __figureextractor__Profiler__
+#define __figureextractor__Profiler__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <iostream>
+
+/**
+  Records the wall and CPU time spent in each stage of processing a document,
+  and counters of the work done, per page. Stages are timed with
+  PROFILE_SCOPE and counted with PROFILE_COUNT. Both compile to nothing unless
+  PROFILE is defined, and only check a flag when profiling was not enabled at
+  run time. Work is attributed to the page last passed to PROFILE_PAGE on the
+  same thread, or to the document as a whole (page -1) otherwise.
+
+  CPU time is the CPU time of the thread running the stage, so stages run on
+  the writer threads overlap the wall time of the main thread's stages.
+
+  When tracing, every stage and every span marked with PROFILE_SPAN is also
+  kept as an event and can be written in the Chrome trace event format, with
+  one track per thread. Timestamps use the monotonic clock so traces of
+  several processes on one host line up.
+
+  When tracking memory, PIX data is allocated through the profiler so the
+  bytes each stage allocates and keeps can be counted, and the resident set
+  size is sampled around each stage and page. Other allocations, such as
+  BOXAs or poppler's TextPages, are only visible through the resident set
+  size.
+ */
+class Profiler {
+public:
+  Profiler();
+
+  // Starts recording, must be called before any other threads are started
+  void enable();
+
+  // Also keeps events for writeTrace, implies enable()
+  void enableTrace(const std::string &document);
+
+  // Also tracks memory, implies enable(). Must be called before any PIX is
+  // created, since freed PIX data is assumed to start with the profiler's
+  // header, and after the PIX pool is enabled if it is used.
+  void enableMemory();
+
+  bool isEnabled() { return enabled; }
+
+  bool isTracing() { return tracing; }
+
+  bool isTrackingMemory() { return memory; }
+
+  // Names the calling thread's track in the trace
+  void setThreadName(const char *name);
+
+  // Sets the page work on the calling thread is attributed to
+  void setPage(int page);
+
+  int getPage();
+
+  void addTime(const char *stage, double wall, double cpu);
+
+  void addCount(const char *counter, long n);
+
+  void addEvent(const char *name, double start, double end);
+
+  void addMemory(const char *stage, long pixAllocated, long pixFreed,
+                 long rssGrowth);
+
+  // Writes totals for the document and each page as JSON
+  void writeJSON(std::ostream &output);
+
+  // Writes the events recorded as Chrome trace event JSON
+  void writeTrace(std::ostream &output);
+
+  // Writes memory use for the document, each stage and each page as JSON.
+  // Returns the number of pages that kept PIX memory allocated after they
+  // were done.
+  int writeMemoryJSON(std::ostream &output);
+
+  // Resident set size in bytes
+  static long getRSS();
+
+  static long getPeakRSS();
+
+  // Bytes of PIX data the calling thread allocated and freed so far
+  static void getPixBytes(long *allocated, long *freed);
+
+  // In seconds
+  static double getWallTime();
+
+  static double getThreadCPUTime();
+
+private:
+  class StageTime {
+  public:
+    double wall;
+    double cpu;
+    long calls;
+  };
+
+  class Event {
+  public:
+    const char *name;
+    int page;
+    int thread;
+    double start;
+    double end;
+  };
+
+  class StageMemory {
+  public:
+    long pixAllocated;
+    long pixFreed;
+    long rssGrowth;
+  };
+
+  class PageMemory {
+  public:
+    long rssStart;
+    long rssEnd;
+    long peakRSSStart;
+    long peakRSSEnd;
+    long pixStart;
+    long pixEnd;
+    long pixPeak;
+  };
+
+  typedef std::map<std::string, StageMemory> StageMemories;
+
+  void writeStageMemory(const StageMemories &stages, std::ostream &output);
+
+  typedef std::map<std::string, StageTime> StageTimes;
+  typedef std::map<std::string, long> Counts;
+
+  void writeStages(const StageTimes &stages, const Counts &counts,
+                   std::ostream &output);
+
+  bool enabled;
+  bool tracing;
+  bool memory;
+  std::string document;
+  double startWall;
+  double startCPU;
+  std::mutex lock;
+  std::map<int, StageTimes> times;
+  std::map<int, Counts> counts;
+  std::vector<Event> events;
+  std::map<int, std::string> threadNames;
+  std::map<int, StageMemories> stageMemory;
+  std::map<int, PageMemory> pageMemory;
+};
+
+Profiler &getProfiler();
+
+// Times the enclosing scope as a stage, or only traces it if isStage is false
+class ProfileScope {
+public:
+  ProfileScope(const char *stage, bool isStage);
+
+  ~ProfileScope();
+
+private:
+  const char *stage;
+  bool isStage;
+  double wall;
+  double cpu;
+  long pixAllocated;
+  long pixFreed;
+  long rss;
+};
+
+#ifdef PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage)                                                  \
+  ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(stage, true)
+#define PROFILE_SPAN(name)                                                    \
+  ProfileScope PROFILE_CONCAT(profileSpan, __LINE__)(name, false)
+#define PROFILE_COUNT(counter, n) getProfiler().addCount(counter, n)
+#define PROFILE_PAGE(page) getProfiler().setPage(page)
+#define PROFILE_THREAD(name) getProfiler().setThreadName(name)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_SPAN(name)
+#define PROFILE_COUNT(counter, n)
+#define PROFILE_PAGE(page)
+#define PROFILE_THREAD(name)
+#endif
+
+#endif /* defined(__figureextractor__Profiler__) */
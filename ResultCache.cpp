@@ -0,0 +1,292 @@
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <ctime>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "ResultCache.h"
+
+namespace {
+
+const char *manifestName = "manifest";
+const char *pagesDir = "pages";
+
+std::string toHex(uint64_t value) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value);
+  return std::string(buf);
+}
+
+bool copyFile(const std::string &from, const std::string &to) {
+  std::ifstream input(from.c_str(), std::ios::binary);
+  if (not input)
+    return false;
+  std::ofstream output(to.c_str(), std::ios::binary);
+  output << input.rdbuf();
+  output.close();
+  return not output.fail();
+}
+
+// Removes a cache entry directory, entries never contain sub-directories
+void removeEntry(const std::string &path) {
+  DIR *d = opendir(path.c_str());
+  if (d != NULL) {
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+      std::string name = ent->d_name;
+      if (name != "." and name != "..")
+        unlink((path + "/" + name).c_str());
+    }
+    closedir(d);
+  }
+  rmdir(path.c_str());
+}
+
+// A name that is unique to this process and call
+std::string uniqueName(const std::string &tag) {
+  static int counter = 0;
+  return tag + "-" + std::to_string(getpid()) + "-" +
+         std::to_string(counter++);
+}
+
+} // end namespace
+
+uint64_t hashBytes(const void *data, size_t length, uint64_t hash) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+ResultCache::ResultCache(const std::string &dir, long long maxBytes)
+    : dir(dir), maxBytes(maxBytes) {
+  mkdir(dir.c_str(), 0777);
+  mkdir((dir + "/" + pagesDir).c_str(), 0777);
+}
+
+bool ResultCache::setKey(const std::string &pdfPath,
+                         const std::string &options) {
+  FILE *file = fopen(pdfPath.c_str(), "rb");
+  if (file == NULL)
+    return false;
+  std::vector<char> buf = std::vector<char>(1 << 20);
+  uint64_t hash = hashBytes(NULL, 0);
+  long long size = 0;
+  size_t n;
+  while ((n = fread(&buf[0], 1, buf.size(), file)) > 0) {
+    hash = hashBytes(&buf[0], n, hash);
+    size += n;
+  }
+  bool ok = not ferror(file);
+  fclose(file);
+  if (not ok)
+    return false;
+
+  // The size and options are kept in the entry as well, so a hash collision
+  // would also have to match them to be used
+  std::ostringstream meta;
+  meta << size << "\n" << options;
+  keyMeta = meta.str();
+  key = toHex(hash) + toHex(hashBytes(options.data(), options.size()));
+  return true;
+}
+
+void ResultCache::setPrefix(const std::string &kind,
+                            const std::string &prefix) {
+  prefixes[kind] = prefix;
+}
+
+bool ResultCache::restore() {
+  std::string entry = dir + "/" + key;
+  std::ifstream manifest((entry + "/" + manifestName).c_str());
+  if (not manifest)
+    return false;
+  std::string meta;
+  size_t metaLength;
+  if (not(manifest >> metaLength) or manifest.get() != '\n')
+    return false;
+  meta.resize(metaLength);
+  if (metaLength > 0 and not manifest.read(&meta[0], metaLength))
+    return false;
+  if (meta != keyMeta or manifest.get() != '\n')
+    return false;
+
+  std::string kind, suffix;
+  int onFile = 0;
+  while (manifest >> kind and manifest.get() == ' ' and
+         std::getline(manifest, suffix)) {
+    if (prefixes.find(kind) == prefixes.end())
+      return false;
+    std::string stored = entry + "/" + std::to_string(onFile++);
+    // Copies can fail if the entry is evicted while we read it, in which
+    // case we treat this as a miss and the caller regenerates the output
+    if (not copyFile(stored, prefixes[kind] + suffix))
+      return false;
+  }
+
+  // Mark the entry as recently used
+  utime((entry + "/" + manifestName).c_str(), NULL);
+  return true;
+}
+
+void ResultCache::addOutput(const std::string &kind, const std::string &path) {
+  outputs.push_back(std::pair<std::string, std::string>(kind, path));
+}
+
+bool ResultCache::store() {
+  std::string tmp = dir + "/" + uniqueName("tmp");
+  if (mkdir(tmp.c_str(), 0777) != 0)
+    return false;
+  std::ofstream manifest((tmp + "/" + manifestName).c_str());
+  manifest << keyMeta.size() << "\n" << keyMeta << "\n";
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    const std::string &prefix = prefixes[outputs[i].first];
+    const std::string &path = outputs[i].second;
+    if (path.compare(0, prefix.length(), prefix) != 0 or
+        not copyFile(path, tmp + "/" + std::to_string(i))) {
+      manifest.close();
+      removeEntry(tmp);
+      return false;
+    }
+    manifest << outputs[i].first << " " << path.substr(prefix.length())
+             << "\n";
+  }
+  manifest.close();
+  if (manifest.fail() or rename(tmp.c_str(), (dir + "/" + key).c_str()) != 0) {
+    // Most likely another process stored this entry first
+    removeEntry(tmp);
+    return false;
+  }
+  if (maxBytes > 0)
+    evict();
+  return true;
+}
+
+bool ResultCache::lookupPage(const std::string &pageKey, std::string &data) {
+  std::string path = dir + "/" + pagesDir + "/" + pageKey;
+  std::ifstream input(path.c_str(), std::ios::binary);
+  if (not input)
+    return false;
+  std::ostringstream contents;
+  contents << input.rdbuf();
+  data = contents.str();
+  utime(path.c_str(), NULL);
+  return true;
+}
+
+bool ResultCache::storePage(const std::string &pageKey,
+                            const std::string &data) {
+  std::string tmp = dir + "/" + uniqueName("tmp");
+  std::ofstream output(tmp.c_str(), std::ios::binary);
+  output << data;
+  output.close();
+  if (output.fail() or
+      rename(tmp.c_str(), (dir + "/" + pagesDir + "/" + pageKey).c_str()) !=
+          0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// A cache entry being considered for eviction
+class EntryUse {
+public:
+  EntryUse(time_t lastUse, long long size, std::string path, bool isPage)
+      : lastUse(lastUse), size(size), path(path), isPage(isPage) {}
+
+  bool operator<(const EntryUse &other) const {
+    return lastUse < other.lastUse or
+           (lastUse == other.lastUse and path < other.path);
+  }
+
+  time_t lastUse;
+  long long size;
+  std::string path;
+  bool isPage;
+};
+
+} // end namespace
+
+void ResultCache::evict() {
+  std::vector<EntryUse> entries = std::vector<EntryUse>();
+  long long total = 0;
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL)
+    return;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    std::string name = ent->d_name;
+    std::string entry = dir + "/" + name;
+    struct stat st;
+    if (name == "." or name == ".." or name == pagesDir)
+      continue;
+    if (name.compare(0, 4, "tmp-") == 0) {
+      // Left behind by a process that died while storing an entry
+      if (stat(entry.c_str(), &st) == 0 and time(NULL) - st.st_mtime > 3600) {
+        if (S_ISDIR(st.st_mode))
+          removeEntry(entry);
+        else
+          unlink(entry.c_str());
+      }
+      continue;
+    }
+    if (stat((entry + "/" + manifestName).c_str(), &st) != 0)
+      continue;
+    time_t lastUse = st.st_mtime;
+    long long size = 0;
+    DIR *files = opendir(entry.c_str());
+    if (files == NULL)
+      continue;
+    struct dirent *file;
+    while ((file = readdir(files)) != NULL) {
+      if (stat((entry + "/" + file->d_name).c_str(), &st) == 0 and
+          S_ISREG(st.st_mode))
+        size += st.st_size;
+    }
+    closedir(files);
+    total += size;
+    entries.push_back(EntryUse(lastUse, size, name, false));
+  }
+  closedir(d);
+
+  std::string pages = dir + "/" + pagesDir;
+  d = opendir(pages.c_str());
+  if (d != NULL) {
+    while ((ent = readdir(d)) != NULL) {
+      struct stat st;
+      std::string name = std::string(pagesDir) + "/" + ent->d_name;
+      if (stat((dir + "/" + name).c_str(), &st) == 0 and S_ISREG(st.st_mode)) {
+        total += st.st_size;
+        entries.push_back(EntryUse(st.st_mtime, st.st_size, name, true));
+      }
+    }
+    closedir(d);
+  }
+
+  std::sort(entries.begin(), entries.end());
+  for (size_t i = 0; i < entries.size() and total > maxBytes; ++i) {
+    // Move the entry out of the way first so readers never see it half
+    // removed, if this fails another process is already evicting it
+    std::string victim = dir + "/" + uniqueName("tmp");
+    if (rename((dir + "/" + entries[i].path).c_str(), victim.c_str()) == 0) {
+      if (entries[i].isPage)
+        unlink(victim.c_str());
+      else
+        removeEntry(victim);
+    }
+    total -= entries[i].size;
+  }
+}
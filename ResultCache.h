@@ -0,0 +1,69 @@
+#ifndef __figureextractor__ResultCache__
+#define __figureextractor__ResultCache__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstddef>
+
+// 64-bit FNV-1a hash of data, pass a previous result as hash to extend it
+uint64_t hashBytes(const void *data, size_t length,
+                   uint64_t hash = 14695981039346656037ULL);
+
+/**
+  On-disk cache of pdffigures output keyed by a hash of the PDF's bytes and of
+  the options used to process it. Each entry is a directory holding copies of
+  the files a run produced, so a hit only costs hashing the PDF and copying
+  the results back out.
+
+  Entries are built in a temporary directory and renamed into place, so
+  concurrent processes never see a partial entry. When the cache grows past
+  its size cap, the least recently used entries are evicted.
+ */
+class ResultCache {
+public:
+  // maxBytes <= 0 means the cache size is not limited
+  ResultCache(const std::string &dir, long long maxBytes);
+
+  // Computes the key for the given PDF and options, options should describe
+  // everything that can change the output. Returns false if the PDF could not
+  // be read.
+  bool setKey(const std::string &pdfPath, const std::string &options);
+
+  // Sets where outputs of a given kind (i.e. "json", "figures") are written,
+  // files recorded for that kind are stored relative to this prefix
+  void setPrefix(const std::string &kind, const std::string &prefix);
+
+  // Copies the cached outputs for the current key to their prefixes, returns
+  // false if there is no usable entry
+  bool restore();
+
+  // Records that a file of the given kind was written and should be cached
+  void addOutput(const std::string &kind, const std::string &path);
+
+  // Saves the recorded outputs under the current key, returns false if the
+  // entry could not be written
+  bool store();
+
+  // Per-page entries hold the analysis results of a single page so that pages
+  // that are unchanged between revisions of a document can be reused. Returns
+  // false if there is no entry for pageKey.
+  bool lookupPage(const std::string &pageKey, std::string &data);
+
+  bool storePage(const std::string &pageKey, const std::string &data);
+
+private:
+  std::string dir;
+  long long maxBytes;
+  std::string key;
+  std::string keyMeta;
+  std::map<std::string, std::string> prefixes;
+
+  // (kind, path) of each output written by this run
+  std::vector<std::pair<std::string, std::string>> outputs;
+
+  void evict();
+};
+
+#endif /* defined(__figureextractor__ResultCache__) */
@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TarArchive.h"
+
+namespace {
+
+const size_t blockSize = 512;
+
+uint64_t padBlock(uint64_t n) {
+  return (n + blockSize - 1) / blockSize * blockSize;
+}
+
+// Writes value as width - 1 octal digits and a NUL, returns false if it has
+// more digits than that, such as the size of an entry of 8 GiB or more
+bool putOctal(char *field, size_t width, uint64_t value) {
+  if (value >= (1ULL << (3 * (width - 1))))
+    return false;
+  char digits[24];
+  snprintf(digits, sizeof(digits), "%0*llo", (int)width - 1,
+           (unsigned long long)value);
+  memcpy(field, digits, width);
+  return true;
+}
+
+unsigned int getChecksum(const char *header) {
+  unsigned int sum = 0;
+  for (size_t i = 0; i < blockSize; ++i) {
+    // The checksum field itself counts as spaces
+    if (i >= 148 and i < 156)
+      sum += ' ';
+    else
+      sum += (unsigned char)header[i];
+  }
+  return sum;
+}
+
+bool isZeroBlock(const char *header) {
+  for (size_t i = 0; i < blockSize; ++i) {
+    if (header[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+// Returns false if header is not a valid tar header
+bool readHeader(const char *header, uint64_t *size) {
+  char field[13];
+  memcpy(field, header + 148, 8);
+  field[8] = '\0';
+  unsigned int checksum;
+  if (sscanf(field, "%o", &checksum) != 1 or checksum != getChecksum(header))
+    return false;
+  memcpy(field, header + 124, 12);
+  field[12] = '\0';
+  unsigned long long value;
+  if (sscanf(field, "%llo", &value) != 1)
+    return false;
+  *size = value;
+  return true;
+}
+
+bool writeHeader(const std::string &name, size_t size, char *header) {
+  memset(header, 0, blockSize);
+  // Names that do not fit in the 100 byte name field are split between the
+  // prefix and name fields at a '/'
+  std::string prefix = "";
+  std::string rest = name;
+  if (rest.length() > 100) {
+    size_t split = name.find('/', name.length() - 101);
+    if (split == std::string::npos or split == 0 or split > 155)
+      return false;
+    prefix = name.substr(0, split);
+    rest = name.substr(split + 1);
+  }
+  if (rest.length() == 0)
+    return false;
+  memcpy(header, rest.data(), rest.length());
+  memcpy(header + 345, prefix.data(), prefix.length());
+  if (not putOctal(header + 100, 8, 0644) or not putOctal(header + 108, 8, 0) or
+      not putOctal(header + 116, 8, 0) or
+      not putOctal(header + 124, 12, size) or
+      not putOctal(header + 136, 12, time(NULL)))
+    return false;
+  header[156] = '0';
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  putOctal(header + 148, 7, getChecksum(header));
+  header[155] = ' ';
+  return true;
+}
+
+bool writeAll(int fd, const char *data, size_t size, off_t offset) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t n = pwrite(fd, data + written, size - written, offset + written);
+    if (n <= 0)
+      return false;
+    written += n;
+  }
+  return true;
+}
+
+} // end namespace
+
+TarArchive::TarArchive() : fd(-1), end(0) {}
+
+TarArchive::~TarArchive() {
+  if (fd >= 0)
+    close(fd);
+}
+
+bool TarArchive::open(const std::string &path) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  bool ok = flock(fd, LOCK_SH) == 0 and fstat(fd, &st) == 0 and
+            findEnd(st.st_size);
+  flock(fd, LOCK_UN);
+  // A non-empty file with no members at the start is not ours to append to
+  if (ok and end == 0 and st.st_size > 0) {
+    char header[blockSize];
+    ok = pread(fd, header, blockSize, 0) == (ssize_t)blockSize and
+         isZeroBlock(header);
+  }
+  if (not ok) {
+    close(fd);
+    fd = -1;
+  }
+  return ok;
+}
+
+bool TarArchive::isOpen() { return fd >= 0; }
+
+bool TarArchive::findEnd(uint64_t fileSize) {
+  if (fileSize < end)
+    return false;
+  char header[blockSize];
+  while (end + blockSize <= fileSize) {
+    if (pread(fd, header, blockSize, end) != (ssize_t)blockSize)
+      return false;
+    uint64_t size;
+    if (isZeroBlock(header) or not readHeader(header, &size))
+      break;
+    uint64_t next = end + blockSize + padBlock(size);
+    // Partially written member, it will be overwritten
+    if (next > fileSize)
+      break;
+    end = next;
+  }
+  return true;
+}
+
+bool TarArchive::append(const std::string &name, const char *data,
+                        size_t size, uint64_t *dataOffset) {
+  std::string member = std::string(blockSize, '\0');
+  if (not writeHeader(name, size, &member[0]))
+    return false;
+  member.append(data, size);
+  // Pad the data to a whole block, then add the end-of-archive marker
+  member.append(padBlock(size) - size + 2 * blockSize, '\0');
+
+  if (flock(fd, LOCK_EX) != 0)
+    return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0 and findEnd(st.st_size) and
+            writeAll(fd, member.data(), member.size(), end) and
+            ftruncate(fd, end + member.size()) == 0;
+  if (ok) {
+    *dataOffset = end + blockSize;
+    end += member.size() - 2 * blockSize;
+  }
+  flock(fd, LOCK_UN);
+  return ok;
+}
+
+bool TarArchive::sync() { return fd < 0 or fsync(fd) == 0; }
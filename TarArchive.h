@@ -0,0 +1,46 @@
+#ifndef __figureextractor__TarArchive__
+#define __figureextractor__TarArchive__
+
+#include <string>
+#include <cstdint>
+
+/**
+  Appends files to a ustar archive. Archives are only ever appended to, so
+  several runs can share one archive: each append locks the file, finds the
+  end of the last complete member, writes the new member followed by the
+  end-of-archive marker and unlocks it. Members are never moved, so their
+  data can be read back by seeking to the offsets returned by append().
+ */
+class TarArchive {
+public:
+  TarArchive();
+
+  ~TarArchive();
+
+  // Opens or creates the archive at path, returns false if it could not be
+  // opened or is not a tar archive
+  bool open(const std::string &path);
+
+  bool isOpen();
+
+  // Appends a member named name holding size bytes of data. dataOffset is set
+  // to the position of the data in the archive. Names longer than ustar
+  // allows and data of 8 GiB or more are rejected.
+  bool append(const std::string &name, const char *data, size_t size,
+              uint64_t *dataOffset);
+
+  bool sync();
+
+private:
+  TarArchive(const TarArchive &);
+  TarArchive &operator=(const TarArchive &);
+
+  // Moves end past any members other processes appended
+  bool findEnd(uint64_t fileSize);
+
+  int fd;
+  // End of the last complete member we know of
+  uint64_t end;
+};
+
+#endif /* defined(__figureextractor__TarArchive__) */
@@ -1,8 +1,17 @@
-#include <regex>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
 
 #include <PDFDoc.h>
 
 #include "TextUtils.h"
+#include "Profiler.h"
 
 void printTextProperties(TextPage *page, DocumentStatistics *docStats,
                          bool onlyLineStarts) {
@@ -24,7 +33,8 @@ void printTextProperties(TextPage *page, DocumentStatistics *docStats,
              fi->isBold() ? "T" : "F", fi->isItalic() ? "T" : "F",
              fi->isSerif() ? "T" : "F", fi->isSymbolic() ? "T" : "F",
              docStats->wordIsLarge(word) ? "T" : "F",
-             wordIsItalic(word) ? "T" : "F", wordIsBold(word) ? "T" : "F");
+             docStats->wordIsItalic(word) ? "T" : "F",
+             docStats->wordIsBold(word) ? "T" : "F");
       if (onlyLineStarts) {
         word = NULL;
       } else {
@@ -34,137 +44,298 @@ void printTextProperties(TextPage *page, DocumentStatistics *docStats,
   }
 }
 
-void getTop2Values(std::unordered_map<double, int> map, double *first,
-                   double *second) {
+namespace {
+
+bool fontIsBold(TextFontInfo *fontInfo) {
+  if (fontInfo == NULL)
+    return false;
+  if (fontInfo->isBold())
+    return true;
+  GooString *name = fontInfo->getFontName();
+  return name != NULL and fontNameIsBold(name->getCString());
+}
+
+bool fontIsItalic(TextFontInfo *fontInfo) {
+  if (fontInfo == NULL)
+    return false;
+  if (fontInfo->isItalic())
+    return true;
+  GooString *name = fontInfo->getFontName();
+  return name != NULL and fontNameIsItalic(name->getCString());
+}
+
+// Statistics gathered from a single page, these are computed independently
+// for each page and then merged in page order
+class PageStatistics {
+public:
+  PageStatistics()
+      : lines(0), words(0), hasPageNumber(false), hasHeader(false) {}
+
+  int lines;
+  int words;
+  Histogram lMarginCounts;
+  Histogram rMarginCounts;
+  Histogram boldCentersUp;
+  Histogram boldCentersDown;
+  std::map<double, double> fontSizeCounts;
+
+  // Word counts for each font on the page in the order they were first seen
+  std::vector<std::pair<TextFontInfo *, int>> fontCounts;
+
+  bool hasPageNumber;
+  bool hasHeader;
+  std::string header;
+};
+
+void countFont(PageStatistics &stats, TextFontInfo *fontInfo) {
+  for (size_t i = stats.fontCounts.size(); i-- > 0;) {
+    if (stats.fontCounts[i].first == fontInfo) {
+      stats.fontCounts[i].second += 1;
+      return;
+    }
+  }
+  stats.fontCounts.push_back(std::pair<TextFontInfo *, int>(fontInfo, 1));
+}
+
+// Truncates x to a histogram bin between 0 and maxX. Text can be placed far
+// off the page to hide it, the histograms would grow to span it.
+int getBin(double x, int maxX) {
+  return (int)std::min(std::max(x, 0.0), (double)maxX);
+}
+
+// Gathers the statistics for a page, center is the horizontal center of the
+// page in pixels or negative if page headers should not be checked for, and
+// maxX bounds the x coordinates counted in the histograms
+void collectPageStatistics(TextPage *page, double center, int maxX,
+                           PageStatistics &stats) {
+  int minY = 99999;
+  int maxY = -1;
+  TextLine *botLine = NULL;
+  TextLine *topLine = NULL;
+  std::vector<TextLine *> lines = getLines(page);
+
+  stats.lines = lines.size();
+  for (TextLine *line : lines) {
+    double x, y, x2, y2;
+    getTextLineBB(line, &x, &y, &x2, &y2);
+    if (y < minY) {
+      minY = y;
+      topLine = line;
+    }
+    if (y2 > maxY) {
+      maxY = y2;
+      botLine = line;
+    }
+    int centerUp = getBin(1 + (x + x2) / 2.0, maxX);
+    int centerDown = getBin((x + x2) / 2.0, maxX);
+    stats.lMarginCounts.add(getBin(x + 0.5, maxX), 1);
+    stats.rMarginCounts.add(getBin(x2 + 0.5, maxX), 1);
+    TextWord *word = line->getWords();
+    bool isBold = true;
+    bool isDecimal = matchDecimal(word->getText()->getCString());
+    while (word != NULL) {
+      stats.words += 1;
+      stats.fontSizeCounts[word->getFontSize()] += 1;
+      TextFontInfo *fontInfo = word->getFontInfo(word->getLength() - 1);
+      countFont(stats, fontInfo);
+      isBold = fontIsBold(fontInfo) and isBold;
+      word = word->getNext();
+    }
+    if (isBold and not isDecimal) {
+      stats.boldCentersUp.add(centerUp, 1);
+      stats.boldCentersDown.add(centerDown, 1);
+    }
+  }
+
+  if (center >= 0 and topLine != NULL) {
+    stats.hasPageNumber =
+        botLine->getWords()->getNext() == NULL and
+        matchPageNumber(botLine->getWords()->getText()->getCString());
+    double x = 0, y = 0, x2 = 0, y2 = 0;
+    getTextLineBB(topLine, &x, &y, &x2, &y2);
+    if (std::abs((x2 + x) / 2 - center) < 20) {
+      TextWord *firstWord = topLine->getWords();
+      while (firstWord != NULL) {
+        stats.header += firstWord->getText()->getCString();
+        firstWord = firstWord->getNext();
+      }
+      stats.hasHeader = true;
+    }
+  }
+}
+
+} // end namespace
+
+Histogram::Histogram() : offset(0) {}
+
+void Histogram::add(int value, int count) {
+  if (counts.empty()) {
+    offset = value;
+    counts.push_back(0);
+  } else if (value < offset) {
+    counts.insert(counts.begin(), offset - value, 0);
+    offset = value;
+  } else if (value - offset >= (int)counts.size()) {
+    counts.resize(value - offset + 1, 0);
+  }
+  counts[value - offset] += count;
+}
+
+void Histogram::merge(const Histogram &other) {
+  for (size_t i = 0; i < other.counts.size(); ++i) {
+    if (other.counts[i] != 0)
+      add(other.offset + (int)i, other.counts[i]);
+  }
+}
+
+int Histogram::count(int value) const {
+  if (value < offset or value - offset >= (int)counts.size())
+    return 0;
+  return counts[value - offset];
+}
+
+void Histogram::getTop2Values(double *first, double *second) const {
   int firstCount = -1;
   int secondCount = -1;
   *first = -1;
   *second = -1;
-  for (auto &kv : map) {
-    if (kv.second > firstCount) {
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] == 0)
+      continue;
+    if (counts[i] > firstCount) {
       *second = *first;
       secondCount = firstCount;
-      firstCount = kv.second;
-      *first = kv.first;
-    } else if (kv.second > secondCount) {
-      *second = kv.first;
-      secondCount = kv.second;
+      firstCount = counts[i];
+      *first = offset + (int)i;
+    } else if (counts[i] > secondCount) {
+      *second = offset + (int)i;
+      secondCount = counts[i];
     }
   }
-  if (*first > *second) {
-    double tmp = *first;
-    *first = *second;
-    *first = tmp;
+}
+
+void Histogram::write(std::ostream &output) const {
+  output << offset << " " << counts.size();
+  for (int count : counts) {
+    output << " " << count;
   }
+  output << "\n";
 }
 
-const std::regex integerRegex = std::regex("^[0-9]{1,3}$");
-const std::regex decimalRegex = std::regex("^[0-9]+(\\.[0-9]+)?$");
+void Histogram::writeSaturated(std::ostream &output, int maxCount) const {
+  for (size_t i = 0; i < counts.size(); ++i) {
+    if (counts[i] != 0)
+      output << offset + (int)i << " " << std::min(counts[i], maxCount) << " ";
+  }
+  output << "\n";
+}
+
+bool Histogram::read(std::istream &input) {
+  size_t size;
+  if (not(input >> offset >> size))
+    return false;
+  counts = std::vector<int>(size, 0);
+  for (size_t i = 0; i < size; ++i) {
+    if (not(input >> counts[i]))
+      return false;
+  }
+  return true;
+}
 
 DocumentStatistics::DocumentStatistics(std::vector<TextPage *> &textPages,
                                        PDFDoc *doc, bool verbose) {
+  PROFILE_SCOPE("statistics");
 
   if (verbose)
     printf("\nAnalyzing Document...\n");
-  std::unordered_map<std::string, double> fontNameCounts =
-      std::unordered_map<std::string, double>();
-  std::unordered_map<double, double> fontSizeCounts =
-      std::unordered_map<double, double>();
+  ok = true;
+  numPages = textPages.size();
+
+  // Catalog lookups are not thread safe, so get the page centers up front.
+  // The first page is skipped when looking for page numbers and headers.
+  std::vector<double> centers = std::vector<double>(textPages.size(), -1);
+  for (size_t i = 1; i < textPages.size(); ++i) {
+    centers[i] = doc->getPageMediaWidth(i) / 2 * (100 / 72.0);
+  }
+  // Either side of the page, so rotated pages are covered too
+  std::vector<int> maxXs = std::vector<int>(textPages.size(), 0);
+  for (size_t i = 0; i < textPages.size(); ++i) {
+    maxXs[i] = (int)(std::max(doc->getPageMediaWidth(i + 1),
+                              doc->getPageMediaHeight(i + 1)) *
+                     (100 / 72.0)) +
+               1;
+  }
 
-  boldCentersUp = std::unordered_map<int, int>();
-  boldCentersDown = std::unordered_map<int, int>();
+  std::vector<PageStatistics> pageStats =
+      std::vector<PageStatistics>(textPages.size());
+  std::atomic<size_t> nextPage(0);
+  auto worker = [&]() {
+    for (size_t i = nextPage++; i < textPages.size(); i = nextPage++) {
+      if (textPages.at(i) != NULL)
+        collectPageStatistics(textPages.at(i), centers.at(i), maxXs.at(i),
+                              pageStats.at(i));
+    }
+  };
+  size_t nThreads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), textPages.size());
+  std::vector<std::thread> threads = std::vector<std::thread>();
+  for (size_t i = 1; i < nThreads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
 
-  pageHeaders = std::unordered_map<std::string, int>();
-  rMarginCounts = std::unordered_map<double, int>();
-  lMarginCounts = std::unordered_map<double, int>();
+  // Merge in page order so the result does not depend on scheduling
+  std::vector<double> fontNameCounts = std::vector<double>();
+  std::map<double, double> fontSizeCounts = std::map<double, double>();
   totalWords = 0;
   totalLines = 0;
   int pageNumbers = 0;
-  for (size_t i = 0; i < textPages.size(); ++i) {
-    TextPage *page = textPages.at(i);
-    int minY = 99999;
-    int maxY = -1;
-    TextLine *botLine = NULL;
-    TextLine *topLine = NULL;
-    std::vector<TextLine *> lines = getLines(page);
-
-    totalLines += lines.size();
-    for (TextLine *line : lines) {
-      double x, y, x2, y2;
-      getTextLineBB(line, &x, &y, &x2, &y2);
-      if (y < minY) {
-        minY = y;
-        topLine = line;
-      }
-      if (y2 > maxY) {
-        maxY = y2;
-        botLine = line;
-      }
-      int centerUp = ((int)(1 + (x + x2) / 2.0));
-      int centerDown = ((int)((x + x2) / 2.0));
-      x = (double)((int)(x + 0.5));
-      x2 = (double)((int)(x2 + 0.5));
-      lMarginCounts[x] += 1;
-      rMarginCounts[x2] += 1;
-      TextWord *word = line->getWords();
-      bool isBold = wordIsBold(word);
-      bool isDecimal = regex_match(word->getText()->getCString(), decimalRegex);
-      while (word != NULL) {
-        totalWords += 1;
-        fontSizeCounts[word->getFontSize()] += 1;
-        std::string fontName;
-        if (word->getFontName(word->getLength() - 1) != NULL) {
-          fontName = word->getFontName(word->getLength() - 1)->getCString();
-        } else {
-          fontName = "NULL";
-        }
-        fontNameCounts[fontName] += 1;
-        isBold = wordIsBold(word) and isBold;
-        word = word->getNext();
-      }
-      if (isBold and not isDecimal) {
-        boldCentersUp[centerUp] += 1;
-        boldCentersDown[centerDown] += 1;
-      }
+  for (PageStatistics &stats : pageStats) {
+    totalLines += stats.lines;
+    totalWords += stats.words;
+    lMarginCounts.merge(stats.lMarginCounts);
+    rMarginCounts.merge(stats.rMarginCounts);
+    boldCentersUp.merge(stats.boldCentersUp);
+    boldCentersDown.merge(stats.boldCentersDown);
+    for (auto &fsc : stats.fontSizeCounts) {
+      fontSizeCounts[fsc.first] += fsc.second;
     }
-
-    if (i > 0 and topLine != NULL) {
-      if (botLine->getWords()->getNext() == NULL and
-          regex_match(botLine->getWords()->getText()->getCString(),
-                      integerRegex)) {
-        pageNumbers += 1;
-      }
-      double center = doc->getPageMediaWidth(i) / 2 * (100 / 72.0);
-      double x = 0, y = 0, x2 = 0, y2 = 0;
-      getTextLineBB(topLine, &x, &y, &x2, &y2);
-      if (std::abs((x2 + x) / 2 - center) < 20) {
-        TextWord *firstWord = topLine->getWords();
-        std::string firstLineText = "";
-        while (firstWord != NULL) {
-          firstLineText += firstWord->getText()->getCString();
-          firstWord = firstWord->getNext();
-        }
-        pageHeaders[firstLineText] += 1;
-      }
+    for (auto &fc : stats.fontCounts) {
+      int nameId = fonts.getStyle(fc.first).nameId;
+      if ((int)fontNameCounts.size() <= nameId)
+        fontNameCounts.resize(nameId + 1, 0);
+      fontNameCounts[nameId] += fc.second;
     }
+    if (stats.hasPageNumber)
+      pageNumbers += 1;
+    if (stats.hasHeader)
+      pageHeaders[stats.header] += 1;
   }
 
-  hasPageNumbers = pageNumbers > 5 and pageNumbers > (textPages.size() * .70);
+  int nAnalyzed = textPages.size() - std::count(textPages.begin(),
+                                                textPages.end(),
+                                                (TextPage *)NULL);
+  hasPageNumbers = pageNumbers > 5 and pageNumbers > (nAnalyzed * .70);
   if (hasPageNumbers and verbose) {
-    printf("%d page numbers (%d)\n", pageNumbers, (int)textPages.size());
+    printf("%d page numbers (%d)\n", pageNumbers, nAnalyzed);
   }
 
-  modeFontName = fontNameCounts.begin()->first;
-  for (auto &fnc : fontNameCounts) {
-    if (fontNameCounts[modeFontName] < fnc.second) {
-      modeFontName = fnc.first;
+  modeFontNameId = 0;
+  for (size_t i = 0; i < fontNameCounts.size(); ++i) {
+    if (fontNameCounts[modeFontNameId] < fontNameCounts[i]) {
+      modeFontNameId = i;
     }
   }
 
-  modeFont = fontSizeCounts.begin()->first;
+  modeFont = 0;
+  double modeFontCount = 0;
   for (auto &fsc : fontSizeCounts) {
-    if (fontSizeCounts[modeFont] < fsc.second) {
+    if (modeFontCount < fsc.second) {
       modeFont = fsc.first;
+      modeFontCount = fsc.second;
     }
   }
 
@@ -179,32 +350,36 @@ DocumentStatistics::DocumentStatistics(std::vector<TextPage *> &textPages,
     }
   }
 
-  getTop2Values(lMarginCounts, &lMarginFirst, &lMarginSecond);
-  getTop2Values(rMarginCounts, &rMarginFirst, &rMarginSecond);
+  lMarginCounts.getTop2Values(&lMarginFirst, &lMarginSecond);
+  rMarginCounts.getTop2Values(&rMarginFirst, &rMarginSecond);
 
-  double diff = (lMarginCounts[lMarginFirst] - lMarginCounts[lMarginSecond]) /
+  double diff = (lMarginCounts.count(lMarginFirst) -
+                 lMarginCounts.count(lMarginSecond)) /
                 ((double)totalLines);
   twoColumn = diff < 0.20 and diff > -0.20;
-  diff = (lMarginCounts[lMarginFirst] - lMarginCounts[lMarginSecond]) /
+  diff = (lMarginCounts.count(lMarginFirst) -
+          lMarginCounts.count(lMarginSecond)) /
          ((double)totalLines);
   rightAligned = diff < 0.15 and diff > -0.15;
 
   if (verbose) {
     printf("Margin: \n\t(%0.2f,%d)-(%0.2f,%d) \n\t(%0.2f,%d)-(%0.2f,%d)\n",
-           lMarginFirst, lMarginCounts[lMarginFirst], rMarginFirst,
-           rMarginCounts[rMarginFirst], lMarginSecond,
-           lMarginCounts[lMarginSecond], rMarginSecond,
-           rMarginCounts[rMarginSecond]);
+           lMarginFirst, lMarginCounts.count(lMarginFirst), rMarginFirst,
+           rMarginCounts.count(rMarginFirst), lMarginSecond,
+           lMarginCounts.count(lMarginSecond), rMarginSecond,
+           rMarginCounts.count(rMarginSecond));
     printf("%s Column (%0.2f)\n", twoColumn ? "Two" : "One", diff);
     printf("%s\n", rightAligned ? "Right Aligned" : "Not Right Aligned");
     printf("Analysis Complete.\n\n");
   }
 
   // Detect if the PDF has its text also included as images
-  // by checking to see if an image fills up each page
+  // by checking to see if an image fills up each page, we can stop
+  // at the first page that is not filled
   imageFilled = true;
-  for (int i = 0; i < doc->getNumPages(); ++i) {
-    imageFilled = isFilledByImage(doc, i + 1) and imageFilled;
+  for (int i = 0; i < doc->getNumPages() and imageFilled; ++i) {
+    if (textPages.at(i) != NULL)
+      imageFilled = isFilledByImage(doc, i + 1);
   }
   if (imageFilled and verbose) {
     printf(
@@ -212,6 +387,142 @@ DocumentStatistics::DocumentStatistics(std::vector<TextPage *> &textPages,
   }
 }
 
+namespace {
+
+const std::string statisticsHeader = "pdffigures-statistics";
+const int statisticsVersion = 1;
+
+// Strings are saved as <length> <bytes> so they can contain any character
+void writeString(std::ostream &output, const std::string &str) {
+  output << str.length() << " " << str << "\n";
+}
+
+bool readString(std::istream &input, std::string &str) {
+  size_t length;
+  if (not(input >> length) or input.get() != ' ')
+    return false;
+  str = std::string(length, '\0');
+  return length == 0 or input.read(&str[0], length);
+}
+
+} // end namespace
+
+DocumentStatistics::DocumentStatistics(std::istream &input) : ok(false) {
+  std::string header;
+  int version;
+  if (not(input >> header >> version) or header != statisticsHeader or
+      version != statisticsVersion)
+    return;
+  std::string modeFontName;
+  size_t nHeaders;
+  if (not(input >> numPages >> totalWords >> totalLines >> lMarginFirst >>
+          lMarginSecond >> rMarginFirst >> rMarginSecond >> modeFont >>
+          twoColumn >> rightAligned >> hasPageNumbers >> imageFilled) or
+      not readString(input, modeFontName) or not boldCentersUp.read(input) or
+      not boldCentersDown.read(input) or not(input >> nHeaders))
+    return;
+  for (size_t i = 0; i < nHeaders; ++i) {
+    std::string pageHeader;
+    int count;
+    if (not readString(input, pageHeader) or not(input >> count))
+      return;
+    pageHeaders[pageHeader] = count;
+  }
+  modeFontNameId = fonts.internName(modeFontName);
+  ok = true;
+}
+
+void DocumentStatistics::write(std::ostream &output) {
+  output << statisticsHeader << " " << statisticsVersion << "\n";
+  output.precision(std::numeric_limits<double>::max_digits10);
+  output << numPages << " " << totalWords << " " << totalLines << "\n";
+  output << lMarginFirst << " " << lMarginSecond << " " << rMarginFirst << " "
+         << rMarginSecond << "\n";
+  output << modeFont << "\n";
+  output << twoColumn << " " << rightAligned << " " << hasPageNumbers << " "
+         << imageFilled << "\n";
+  writeString(output, fonts.getName(modeFontNameId));
+  boldCentersUp.write(output);
+  boldCentersDown.write(output);
+  output << pageHeaders.size() << "\n";
+  for (auto &ph : pageHeaders) {
+    writeString(output, ph.first);
+    output << ph.second << "\n";
+  }
+}
+
+void DocumentStatistics::writePageAnalysisKey(std::ostream &output) {
+  output.precision(std::numeric_limits<double>::max_digits10);
+  output << lMarginFirst << " " << lMarginSecond << " " << rMarginFirst << " "
+         << rMarginSecond << "\n";
+  output << modeFont << "\n";
+  output << twoColumn << " " << rightAligned << " " << hasPageNumbers << " "
+         << imageFilled << "\n";
+  writeString(output, fonts.getName(modeFontNameId));
+  // isBoldCentered only checks if the counts add up to 3
+  boldCentersUp.writeSaturated(output, 3);
+  boldCentersDown.writeSaturated(output, 3);
+  // Only membership matters for headers, sort them so the key does not
+  // depend on hash table order
+  std::set<std::string> headers = std::set<std::string>();
+  for (auto &ph : pageHeaders)
+    headers.insert(ph.first);
+  output << headers.size() << "\n";
+  for (const std::string &header : headers)
+    writeString(output, header);
+}
+
+int DocumentStatistics::printDifferences(DocumentStatistics &other) {
+  int differences = 0;
+  auto compare = [&](const char *name, double value, double otherValue) {
+    if (value != otherValue) {
+      printf("%s: %0.2f vs %0.2f\n", name, value, otherValue);
+      differences += 1;
+    }
+  };
+  compare("Left margin", lMarginFirst, other.lMarginFirst);
+  compare("Second left margin", lMarginSecond, other.lMarginSecond);
+  compare("Right margin", rMarginFirst, other.rMarginFirst);
+  compare("Second right margin", rMarginSecond, other.rMarginSecond);
+  compare("Mode font size", modeFont, other.modeFont);
+  compare("Two column", twoColumn, other.twoColumn);
+  compare("Right aligned", rightAligned, other.rightAligned);
+  compare("Page numbers", hasPageNumbers, other.hasPageNumbers);
+  compare("Body text graphical", imageFilled, other.imageFilled);
+  std::string fontName = fonts.getName(modeFontNameId);
+  std::string otherFontName = other.fonts.getName(other.modeFontNameId);
+  if (fontName != otherFontName) {
+    printf("Mode font: %s vs %s\n", fontName.c_str(), otherFontName.c_str());
+    differences += 1;
+  }
+  std::ostringstream centers, otherCenters;
+  boldCentersUp.writeSaturated(centers, 3);
+  boldCentersDown.writeSaturated(centers, 3);
+  other.boldCentersUp.writeSaturated(otherCenters, 3);
+  other.boldCentersDown.writeSaturated(otherCenters, 3);
+  if (centers.str() != otherCenters.str()) {
+    printf("Bold centers differ\n");
+    differences += 1;
+  }
+  for (auto &ph : pageHeaders) {
+    if (other.pageHeaders.find(ph.first) == other.pageHeaders.end()) {
+      printf("Page header only in first: <%s>\n", ph.first.c_str());
+      differences += 1;
+    }
+  }
+  for (auto &ph : other.pageHeaders) {
+    if (pageHeaders.find(ph.first) == pageHeaders.end()) {
+      printf("Page header only in second: <%s>\n", ph.first.c_str());
+      differences += 1;
+    }
+  }
+  return differences;
+}
+
+bool DocumentStatistics::isOk() { return ok; }
+
+int DocumentStatistics::getNumPages() { return numPages; }
+
 bool DocumentStatistics::isBodyTextGraphical() { return imageFilled; }
 
 bool DocumentStatistics::documentIsTwoColumn() { return twoColumn; }
@@ -232,7 +543,8 @@ bool DocumentStatistics::isBoldCentered(double x, double x2) {
   }
   int centerUp = ((int)1 + (x + x2) / 2.0);
   int centerDown = ((int)(x + x2) / 2.0);
-  return boldCentersUp[centerUp] + boldCentersDown[centerDown] >= 3;
+  return boldCentersUp.count(centerUp) + boldCentersDown.count(centerDown) >=
+         3;
 }
 
 bool DocumentStatistics::isPageHeader(TextLine *line) {
@@ -248,7 +560,7 @@ bool DocumentStatistics::isPageHeader(TextLine *line) {
 bool DocumentStatistics::isPageNumber(TextLine *line) {
   if (hasPageNumbers) {
     if (line->getWords()->getNext() == NULL and
-        regex_match(line->getWords()->getText()->getCString(), integerRegex)) {
+        matchPageNumber(line->getWords()->getText()->getCString())) {
       return true;
     }
   }
@@ -263,10 +575,15 @@ bool DocumentStatistics::wordIsLarge(TextWord *word) {
 double DocumentStatistics::getModeFont() { return modeFont; }
 
 bool DocumentStatistics::wordIsStandardFont(TextWord *word) {
-  return (word->getFontName(word->getLength() - 1) == NULL &&
-          modeFontName == "NULL") ||
-         (modeFontName.compare(
-              word->getFontName(word->getLength() - 1)->getCString()) == 0);
+  return fonts.getStyle(word).nameId == modeFontNameId;
+}
+
+bool DocumentStatistics::wordIsBold(TextWord *word) {
+  return fonts.getStyle(word).bold;
+}
+
+bool DocumentStatistics::wordIsItalic(TextWord *word) {
+  return fonts.getStyle(word).italic;
 }
 
 int DocumentStatistics::lineIsAligned(double x, double x2) {
@@ -338,36 +655,129 @@ void getTextLineBB(TextLine *line, double *minX, double *minY, double *maxX,
   }
 }
 
-const std::regex italicFontRegex = std::regex(".*(Slant|Itatlic).*");
+FontTable::FontTable() : lastFontInfo(NULL), lastStyleId(-1) {
+  // Reserve id 0 for words without font information
+  styles.push_back(FontStyle(internName("NULL"), false, false, false));
+}
 
-bool wordIsItalic(TextWord *const word) {
-  if (word->getFontInfo(word->getLength() - 1) != NULL and
-      word->getFontInfo(word->getLength() - 1)->isItalic())
-    return true;
-  if (word->getFontName(word->getLength() - 1) == NULL) {
+FontStyle FontTable::getStyle(TextWord *word) {
+  return getStyle(word->getFontInfo(word->getLength() - 1));
+}
+
+FontStyle FontTable::getStyle(TextFontInfo *fontInfo) {
+  if (fontInfo == NULL)
+    return styles.front();
+  if (fontInfo == lastFontInfo)
+    return styles[lastStyleId];
+  std::unordered_map<TextFontInfo *, int>::iterator it =
+      styleIds.find(fontInfo);
+  int styleId;
+  if (it != styleIds.end()) {
+    styleId = it->second;
+  } else {
+    GooString *name = fontInfo->getFontName();
+    const char *nameStr = name == NULL ? NULL : name->getCString();
+    styles.push_back(FontStyle(internName(nameStr == NULL ? "NULL" : nameStr),
+                               fontIsBold(fontInfo), fontIsItalic(fontInfo),
+                               fontInfo->isSerif()));
+    styleId = styles.size() - 1;
+    styleIds[fontInfo] = styleId;
+  }
+  lastFontInfo = fontInfo;
+  lastStyleId = styleId;
+  return styles[styleId];
+}
+
+int FontTable::internName(const std::string &name) {
+  std::unordered_map<std::string, int>::iterator it = nameIds.find(name);
+  if (it != nameIds.end())
+    return it->second;
+  names.push_back(name);
+  nameIds[name] = names.size() - 1;
+  return names.size() - 1;
+}
+
+const std::string &FontTable::getName(int nameId) { return names.at(nameId); }
+
+bool wordEndsWithPeriod(TextWord *const word) {
+  return *word->getChar(word->getLength() - 1) == Unicode('.');
+}
+
+namespace {
+
+// Number of consecutive ASCII digits at the start of text
+int digitRun(const char *text) {
+  int n = 0;
+  while (text[n] >= '0' and text[n] <= '9')
+    ++n;
+  return n;
+}
+
+// Equivalent to matching .*(first|second).* where '.' excludes line breaks
+bool containsOnSingleLine(const char *text, const char *first,
+                          const char *second) {
+  if (strpbrk(text, "\n\r") != NULL)
+    return false;
+  return strstr(text, first) != NULL or strstr(text, second) != NULL;
+}
+
+} // end namespace
+
+bool matchCaptionWord(const char *text, bool *caps, bool *abbreviated) {
+  *caps = strcmp(text, "FIG") == 0;
+  *abbreviated = strcmp(text, "Fig.") == 0;
+  return *caps or *abbreviated or strcmp(text, "Figure") == 0 or
+         strcmp(text, "Fig") == 0 or strcmp(text, "Table") == 0;
+}
+
+bool matchCaptionNumber(const char *text, int *numberLength) {
+  int n = digitRun(text);
+  if (n == 0)
+    return false;
+  *numberLength = n;
+  if (text[n] == ':' or text[n] == '.')
+    ++n;
+  return text[n] == '\0';
+}
+
+bool matchDecimal(const char *text) {
+  int n = digitRun(text);
+  if (n == 0)
     return false;
+  if (text[n] == '.') {
+    int fraction = digitRun(text + n + 1);
+    if (fraction == 0)
+      return false;
+    n += 1 + fraction;
   }
-  std::match_results<const char *> italicFontMatch;
-  std::regex_match(word->getFontName(word->getLength() - 1)->getCString(),
-                   italicFontMatch, italicFontRegex);
-  return not italicFontMatch.empty();
+  return text[n] == '\0';
 }
 
-const std::regex boldFontRegex = std::regex(".*(Medi|Bold).*");
+bool matchPageNumber(const char *text) {
+  int n = digitRun(text);
+  return n >= 1 and n <= 3 and text[n] == '\0';
+}
 
-bool wordIsBold(TextWord *const word) {
-  if (word->getFontInfo(word->getLength() - 1) != NULL and
-      word->getFontInfo(word->getLength() - 1)->isBold())
-    return true;
-  if (word->getFontName(word->getLength() - 1) == NULL) {
+bool matchTitleNumber(const char *text) {
+  int n = digitRun(text);
+  if (n < 1 or n > 2)
     return false;
+  if (text[n] == '.') {
+    int fraction = digitRun(text + n + 1);
+    if (fraction > 3)
+      return false;
+    if (fraction > 0)
+      n += 1 + fraction;
   }
-  std::match_results<const char *> boldFontMatch;
-  std::regex_match(word->getFontName(word->getLength() - 1)->getCString(),
-                   boldFontMatch, boldFontRegex);
-  return not boldFontMatch.empty();
+  if (text[n] == '.')
+    ++n;
+  return text[n] == '\0';
 }
 
-bool wordEndsWithPeriod(TextWord *const word) {
-  return *word->getChar(word->getLength() - 1) == Unicode('.');
+bool fontNameIsBold(const char *name) {
+  return containsOnSingleLine(name, "Medi", "Bold");
+}
+
+bool fontNameIsItalic(const char *name) {
+  return containsOnSingleLine(name, "Slant", "Itatlic");
 }
@@ -4,16 +4,112 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <iostream>
 
 #include <TextOutputDev.h>
 #include <Page.h>
 #include "PDFUtils.h"
 
+// How a font is styled, as used by our text heuristics
+class FontStyle {
+public:
+  FontStyle(int nameId, bool bold, bool italic, bool serif)
+      : nameId(nameId), bold(bold), italic(italic), serif(serif) {}
+
+  int nameId; // Interned font name, see FontTable
+  bool bold;
+  bool italic;
+  bool serif;
+};
+
+/*
+  Per-document table of fonts. Font names are interned and each TextFontInfo
+  is classified the first time it is seen, so later style checks are a lookup
+  instead of a scan of the font's name. Documents have few fonts but many
+  words so this table stays small.
+ **/
+class FontTable {
+public:
+  FontTable();
+
+  // Style of the font used by the last character of word
+  FontStyle getStyle(TextWord *word);
+
+  FontStyle getStyle(TextFontInfo *fontInfo);
+
+  // Returns the id of the given font name, missing names are given "NULL"
+  int internName(const std::string &name);
+
+  const std::string &getName(int nameId);
+
+private:
+  std::unordered_map<TextFontInfo *, int> styleIds;
+  std::vector<FontStyle> styles;
+  std::unordered_map<std::string, int> nameIds;
+  std::vector<std::string> names;
+
+  // Consecutive words usually share a font, remember the last lookup
+  TextFontInfo *lastFontInfo;
+  int lastStyleId;
+};
+
+// Counts of integer values, stored densely so that merging two histograms and
+// finding the most common values are linear scans
+class Histogram {
+public:
+  Histogram();
+
+  void add(int value, int count);
+
+  void merge(const Histogram &other);
+
+  int count(int value) const;
+
+  // Finds the two most frequent values, ties go to the smaller value and
+  // missing values are set to -1
+  void getTop2Values(double *first, double *second) const;
+
+  void write(std::ostream &output) const;
+
+  // Writes the non-zero values with their counts capped at maxCount
+  void writeSaturated(std::ostream &output, int maxCount) const;
+
+  // Reads a histogram saved by write, returns false on malformed input
+  bool read(std::istream &input);
+
+private:
+  int offset;
+  std::vector<int> counts;
+};
+
 // Class to track document level statistics
 class DocumentStatistics {
 public:
+  // Pages that are NULL in textPages are skipped, so the statistics can be
+  // built from a sample of the document's pages
   DocumentStatistics(std::vector<TextPage *> &textPages, PDFDoc *doc,
                      bool quiet);
+
+  // Loads statistics saved by write, check isOk() before using the result
+  DocumentStatistics(std::istream &input);
+
+  // Saves these statistics so page level analysis can be run in a separate
+  // process without re-analyzing the whole document
+  void write(std::ostream &output);
+
+  // Writes only what page level analysis depends on, pages analyzed using
+  // statistics with equal keys produce equal results so small changes to a
+  // document (word counts, margin counts) do not invalidate cached pages
+  void writePageAnalysisKey(std::ostream &output);
+
+  // Prints the statistics page level analysis depends on that differ between
+  // this and other, returns the number of differences
+  int printDifferences(DocumentStatistics &other);
+
+  bool isOk();
+
+  int getNumPages();
+
   double getModeFont();
 
   bool wordIsLarge(TextWord *word);
@@ -22,6 +118,10 @@ public:
 
   bool wordIsStandardFont(TextWord *word);
 
+  bool wordIsBold(TextWord *word);
+
+  bool wordIsItalic(TextWord *word);
+
   int lineIsAlignedToTol(double x, double x2, double l_tol, double r_tol);
 
   bool isPageHeader(TextLine *line);
@@ -37,6 +137,8 @@ public:
   bool isBodyTextGraphical();
 
 private:
+  bool ok;
+  int numPages;
   int totalWords;
   int totalLines;
   double lMarginFirst;
@@ -44,18 +146,20 @@ private:
   double rMarginFirst;
   double rMarginSecond;
   double modeFont;
-  std::string modeFontName;
+  int modeFontNameId;
+
+  FontTable fonts;
 
   bool twoColumn;
   bool rightAligned;
   bool hasPageNumbers;
   bool imageFilled;
 
-  std::unordered_map<int, int> boldCentersUp;
-  std::unordered_map<int, int> boldCentersDown;
+  Histogram boldCentersUp;
+  Histogram boldCentersDown;
   std::unordered_map<std::string, int> pageHeaders;
-  std::unordered_map<double, int> rMarginCounts;
-  std::unordered_map<double, int> lMarginCounts;
+  Histogram rMarginCounts;
+  Histogram lMarginCounts;
 };
 
 // Debugging
@@ -67,10 +171,35 @@ std::vector<TextLine *> getLines(TextPage *textPage);
 void getTextLineBB(TextLine *line, double *minX, double *minY, double *maxX,
                    double *maxY);
 
-bool wordIsItalic(TextWord *const word);
+bool wordEndsWithPeriod(TextWord *const word);
 
-bool wordIsBold(TextWord *const word);
+/*
+  Hand-written matchers for the patterns we check words and font names
+  against. Each accepts exactly the strings matched by the regular expression
+  given in its comment, they exist because std::regex is too slow to run on
+  every word of a document.
+ **/
 
-bool wordEndsWithPeriod(TextWord *const word);
+// ^(Figure|(FIG)|(Fig\.)|Fig|Table)$, sets caps for 'FIG' and abbreviated
+// for 'Fig.'
+bool matchCaptionWord(const char *text, bool *caps, bool *abbreviated);
+
+// ^([0-9]+)(:|\.)?$, sets numberLength to the number of leading digits
+bool matchCaptionNumber(const char *text, int *numberLength);
+
+// ^[0-9]+(\.[0-9]+)?$
+bool matchDecimal(const char *text);
+
+// ^[0-9]{1,3}$
+bool matchPageNumber(const char *text);
+
+// ^[0-9]{1,2}(\.[0-9]{1,3})?\.?$
+bool matchTitleNumber(const char *text);
+
+// .*(Medi|Bold).*
+bool fontNameIsBold(const char *name);
+
+// .*(Slant|Itatlic).*
+bool fontNameIsItalic(const char *name);
 
 #endif
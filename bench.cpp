@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include <PDFDocFactory.h>
+#include <GlobalParams.h>
+#include <ErrorCodes.h>
+#include <SplashOutputDev.h>
+#include <splash/SplashBitmap.h>
+#include <getopt.h>
+
+#include "ExtractCaptions.h"
+#include "BuildCaptions.h"
+#include "PDFUtils.h"
+#include "ExtractRegions.h"
+#include "ExtractFigures.h"
+#include "FigureRecord.h"
+#include "Profiler.h"
+
+namespace {
+
+// Same as pdffigures
+const double resolution = 100;
+
+/*
+  Times kernels and keeps the time of every call. Each kernel is called once
+  to warm up, then repeatedly until it has run at least minIterations times
+  and for at least minSeconds.
+ */
+class Bench {
+public:
+  Bench(double minSeconds, int minIterations, const std::string &filter)
+      : minSeconds(minSeconds), minIterations(minIterations), filter(filter),
+        results(std::vector<Result>()) {}
+
+  // setup is called before every call to kernel and is not timed
+  void run(const char *name, const std::string &fixture,
+           const std::function<void()> &setup,
+           const std::function<void()> &kernel) {
+    if (std::string(name).find(filter) == std::string::npos)
+      return;
+    Result result;
+    result.name = name;
+    result.fixture = fixture;
+    result.times = std::vector<double>();
+    setup();
+    kernel();
+    double total = 0;
+    while ((int)result.times.size() < minIterations or total < minSeconds) {
+      setup();
+      double start = Profiler::getWallTime();
+      kernel();
+      double time = Profiler::getWallTime() - start;
+      result.times.push_back(time);
+      total += time;
+    }
+    std::sort(result.times.begin(), result.times.end());
+    printf("%-28s %-32s %8.3f ms (%d runs)\n", name, fixture.c_str(),
+           getMedian(result.times) * 1000, (int)result.times.size());
+    results.push_back(result);
+  }
+
+  // Writes a JSON object with the times of every benchmark in seconds
+  void writeJSON(const std::vector<std::string> &fixtures,
+                 std::ostream &output) {
+    std::string buffer = "";
+    output << "{\"Fixtures\": [";
+    for (size_t i = 0; i < fixtures.size(); ++i) {
+      output << (i == 0 ? "" : ", ") << "\""
+             << escape(fixtures.at(i), buffer) << "\"";
+    }
+    output << "],\n\"MinSeconds\": " << minSeconds
+           << ", \"MinIterations\": " << minIterations
+           << ",\n\"Benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result &result = results.at(i);
+      double mean = 0;
+      for (double time : result.times)
+        mean += time / result.times.size();
+      output << (i == 0 ? "" : ",") << "\n{\"Name\": \"" << result.name
+             << "\", \"Fixture\": \"" << escape(result.fixture, buffer)
+             << "\", \"Iterations\": " << result.times.size()
+             << ", \"Min\": " << result.times.front()
+             << ", \"Median\": " << getMedian(result.times)
+             << ", \"Mean\": " << mean
+             << ", \"Max\": " << result.times.back() << "}";
+    }
+    output << "\n]}\n";
+  }
+
+private:
+  class Result {
+  public:
+    std::string name;
+    std::string fixture;
+    // In seconds, sorted
+    std::vector<double> times;
+  };
+
+  static double getMedian(const std::vector<double> &times) {
+    size_t n = times.size();
+    return n % 2 == 1 ? times.at(n / 2)
+                      : (times.at(n / 2 - 1) + times.at(n / 2)) / 2;
+  }
+
+  static const std::string &escape(const std::string &text,
+                                   std::string &buffer) {
+    buffer.clear();
+    appendJSONEscaped(text.data(), text.size(), buffer);
+    return buffer;
+  }
+
+  double minSeconds;
+  int minIterations;
+  std::string filter;
+  std::vector<Result> results;
+};
+
+bool readFile(const std::string &name, std::string &contents) {
+  std::ifstream input(name.c_str(), std::ios::binary);
+  if (not input)
+    return false;
+  std::ostringstream buffer;
+  buffer << input.rdbuf();
+  contents = buffer.str();
+  return true;
+}
+
+/*
+  Saves the given pages (numbered from 0) of pdf as fixtures in dir. Each
+  fixture is the page as a single page PDF, <name>-<page#>.pdf, with the
+  statistics of the whole document, <name>-<page#>.stats, and the caption
+  starts the whole document analysis found on that page,
+  <name>-<page#>.captions. Records the pages with captions if pages is empty.
+ */
+int recordFixtures(const std::string &pdf, std::vector<int> pages,
+                   const std::string &dir) {
+  std::unique_ptr<PDFDoc> doc(
+      PDFDocFactory().createPDFDoc(GooString(pdf.c_str()), NULL, NULL));
+  if (not doc->isOk()) {
+    printf("Could not open %s\n", pdf.c_str());
+    return 1;
+  }
+  std::vector<TextPage *> textPages = getTextPages(doc.get(), resolution);
+  DocumentStatistics docStats(textPages, doc.get(), false);
+  std::map<int, std::vector<CaptionStart>> captionStarts =
+      extractCaptionsFromText(textPages, docStats, false);
+  if (pages.size() == 0) {
+    for (auto &starts : captionStarts)
+      pages.push_back(starts.first);
+    if (pages.size() == 0)
+      pages.push_back(0);
+  }
+
+  std::string name = pdf.substr(pdf.find_last_of('/') + 1);
+  if (name.size() > 4 and name.substr(name.size() - 4) == ".pdf")
+    name = name.substr(0, name.size() - 4);
+  for (int page : pages) {
+    if (page < 0 or page >= doc->getNumPages()) {
+      printf("%s has no page %d\n", pdf.c_str(), page + 1);
+      return 1;
+    }
+    std::string prefix = dir + "/" + name + "-" + std::to_string(page + 1);
+    GooString pageFile((prefix + ".pdf").c_str());
+    if (doc->savePageAs(&pageFile, page + 1) != errNone) {
+      printf("Could not write %s.pdf\n", prefix.c_str());
+      return 1;
+    }
+    std::ofstream statsOutput((prefix + ".stats").c_str());
+    docStats.write(statsOutput);
+
+    // The fixture's page is the first page of its own document
+    std::map<int, std::vector<CaptionStart>> pageStarts =
+        std::map<int, std::vector<CaptionStart>>();
+    pageStarts[0] = std::vector<CaptionStart>();
+    for (const CaptionStart &start : captionStarts[page]) {
+      pageStarts[0].push_back(
+          CaptionStart(0, start.number, start.word, start.type));
+    }
+    std::vector<TextPage *> pageText = std::vector<TextPage *>(1);
+    pageText.at(0) = textPages.at(page);
+    std::ofstream captionsOutput((prefix + ".captions").c_str());
+    writeCaptionStarts(pageStarts, pageText, captionsOutput);
+    if (not statsOutput or not captionsOutput) {
+      printf("Could not write the fixture %s\n", prefix.c_str());
+      return 1;
+    }
+    printf("Recorded %s\n", prefix.c_str());
+  }
+  for (TextPage *text : textPages)
+    text->decRefCnt();
+  return 0;
+}
+
+// Runs every benchmark on the fixture dir/name, returns false if the fixture
+// could not be loaded
+bool benchFixture(Bench &bench, const std::string &dir,
+                  const std::string &name) {
+  std::string prefix = dir + "/" + name;
+  std::unique_ptr<PDFDoc> doc(PDFDocFactory().createPDFDoc(
+      GooString((prefix + ".pdf").c_str()), NULL, NULL));
+  std::string statsData;
+  if (not doc->isOk() or not readFile(prefix + ".stats", statsData))
+    return false;
+  std::istringstream statsInput(statsData);
+  DocumentStatistics docStats(statsInput);
+  if (not docStats.isOk())
+    return false;
+  std::vector<TextPage *> pages = std::vector<TextPage *>(1);
+  pages.at(0) = getTextPage(doc.get(), 1, resolution);
+  std::map<int, std::vector<CaptionStart>> captionStarts =
+      std::map<int, std::vector<CaptionStart>>();
+  std::ifstream captionsInput((prefix + ".captions").c_str());
+  if (not readCaptionStarts(captionsInput, pages, captionStarts)) {
+    pages.at(0)->decRefCnt();
+    return false;
+  }
+  std::vector<CaptionStart> &starts = captionStarts[0];
+  std::function<void()> noSetup = []() {};
+
+  bench.run("DocumentStatistics read", name, noSetup, [&]() {
+    std::istringstream input(statsData);
+    DocumentStatistics loaded(input);
+  });
+  bench.run("DocumentStatistics", name, noSetup, [&]() {
+    DocumentStatistics pageStats(pages, doc.get(), false);
+  });
+  // Builds a CaptionCandidate (constructCandidate) for every word
+  bench.run("extractCaptionsFromText", name, noSetup,
+            [&]() { extractCaptionsFromText(pages, docStats, false); });
+
+  std::string text = "";
+  TextWordList *wordList = pages.at(0)->makeWordList(gFalse);
+  for (int i = 0; i < wordList->getLength(); ++i) {
+    GooString *word = wordList->get(i)->getText();
+    text += std::string(word->getCString(), word->getLength()) + " ";
+  }
+  delete wordList;
+  std::string escaped = "";
+  bench.run("appendJSONEscaped", name, [&]() { escaped.clear(); },
+            [&]() { appendJSONEscaped(text.data(), text.size(), escaped); });
+
+  SplashColor paperColor = {255, 255, 255};
+  std::unique_ptr<SplashOutputDev> mono(
+      new SplashOutputDev(splashModeMono8, 4, gFalse, paperColor));
+  mono->startDoc(doc.get());
+  doc->displayPage(mono.get(), 1, resolution, resolution, 0, gTrue, gFalse,
+                   gFalse);
+  bench.run("bitmapToPix", name, noSetup,
+            [&]() { PixPtr pix(bitmapToPix(mono->getBitmap())); });
+  mono.reset();
+  std::unique_ptr<SplashOutputDev> color(
+      new SplashOutputDev(splashModeRGB8, 4, gFalse, paperColor));
+  color->startDoc(doc.get());
+  doc->displayPage(color.get(), 1, resolution, resolution, 0, gTrue, gFalse,
+                   gFalse);
+  bench.run("fullColorBitmapToPix", name, noSetup,
+            [&]() { PixPtr pix(fullColorBitmapToPix(color->getBitmap())); });
+  color.reset();
+
+  // The images the page analysis runs on, made as pdffigures makes them
+  PixPtr fullRender = getFullRenderPix(doc.get(), 1, resolution);
+  PixPtr fullRender1d(pixConvertTo1(fullRender.get(), 250));
+  PixPtr graphics1d;
+  if (not docStats.isBodyTextGraphical()) {
+    PixPtr graphics = getGraphicOnlyPix(doc.get(), 1, resolution);
+    graphics1d.reset(pixConvertTo1(graphics.get(), 250));
+  } else {
+    graphics1d.reset(pixCreateTemplate(fullRender1d.get()));
+  }
+  pixAnd(graphics1d.get(), graphics1d.get(), fullRender1d.get());
+
+  bench.run("buildCaptions", name, noSetup, [&]() {
+    buildCaptions(starts, docStats, pages.at(0), graphics1d.get(), false);
+  });
+  std::vector<Caption> captions =
+      buildCaptions(starts, docStats, pages.at(0), graphics1d.get(), false);
+
+  std::vector<Figure> errors = std::vector<Figure>();
+  bench.run("getPageRegions", name, noSetup, [&]() {
+    LeptArena pageArena;
+    getPageRegions(fullRender1d.get(), pages.at(0), graphics1d.get(),
+                   captions, docStats, 0, false, false, errors, pageArena);
+  });
+
+  // extractFigures adds to the regions' body text, so every call gets its own
+  // copy of the regions. This times scoring the proposals of each caption
+  // (scoreBox) and the search over their configurations.
+  LeptArena regionsArena;
+  std::unique_ptr<PageRegions> regions;
+  auto makeRegions = [&]() {
+    regionsArena.release();
+    regions.reset(new PageRegions(getPageRegions(
+        fullRender1d.get(), pages.at(0), graphics1d.get(), captions, docStats,
+        0, false, false, errors, regionsArena)));
+  };
+  makeRegions();
+  if (regions->captions.size() != 0) {
+    bench.run("extractFigures", name, makeRegions, [&]() {
+      extractFigures(fullRender1d.get(), *regions, docStats, false, false,
+                     errors);
+    });
+  }
+  pages.at(0)->decRefCnt();
+  return true;
+}
+
+// Names of the fixtures in dir, sorted
+std::vector<std::string> listFixtures(const std::string &dir) {
+  std::vector<std::string> names = std::vector<std::string>();
+  DIR *listing = opendir(dir.c_str());
+  if (listing == NULL)
+    return names;
+  dirent *entry;
+  while ((entry = readdir(listing)) != NULL) {
+    std::string file = entry->d_name;
+    if (file.size() > 6 and file.substr(file.size() - 6) == ".stats")
+      names.push_back(file.substr(0, file.size() - 6));
+  }
+  closedir(listing);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+void printUsage() {
+  printf("Usage: pdffigures-bench [flags] <fixture directory>\n");
+  printf("Times the stages of pdffigures on each page fixture in the "
+         "directory\n");
+  printf("-r, --record <pdf>: Record fixtures of pdf's pages to the directory "
+         "instead\n");
+  printf("-p, --pages <page#,...>: Pages to record, by default the pages with "
+         "captions are recorded\n");
+  printf("-o, --output <file>: Save the times of each run as JSON\n");
+  printf("-t, --min-time <seconds>: Run each benchmark for at least this "
+         "long, default 0.5\n");
+  printf("-n, --min-iterations <n>: Run each benchmark at least n times, "
+         "default 5\n");
+  printf("-k, --filter <name>: Only run benchmarks whose name contains "
+         "name\n");
+  printf("-h, --help show usage\n");
+}
+
+} // end namespace
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+      {"record", required_argument, NULL, 'r'},
+      {"pages", required_argument, NULL, 'p'},
+      {"output", required_argument, NULL, 'o'},
+      {"min-time", required_argument, NULL, 't'},
+      {"min-iterations", required_argument, NULL, 'n'},
+      {"filter", required_argument, NULL, 'k'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0}};
+
+  std::string recordFile = "";
+  std::vector<int> pages = std::vector<int>();
+  std::string outputFile = "";
+  double minSeconds = 0.5;
+  int minIterations = 5;
+  std::string filter = "";
+  int opt;
+  while ((opt = getopt_long(argc, argv, "r:p:o:t:n:k:h", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'r':
+      recordFile = optarg;
+      break;
+    case 'p': {
+      std::istringstream list(optarg);
+      std::string page;
+      while (std::getline(list, page, ','))
+        pages.push_back(std::atoi(page.c_str()) - 1);
+      break;
+    }
+    case 'o':
+      outputFile = optarg;
+      break;
+    case 't':
+      minSeconds = std::atof(optarg);
+      break;
+    case 'n':
+      minIterations = std::max(std::atoi(optarg), 1);
+      break;
+    case 'k':
+      filter = optarg;
+      break;
+    case 'h':
+      printUsage();
+      return 0;
+    default:
+      printUsage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    printUsage();
+    return 1;
+  }
+  std::string dir = argv[optind];
+
+  globalParams = new GlobalParams(); // Set up poppler
+  std::string str = "UTF-8";
+  std::vector<char> writableStr(str.begin(), str.end());
+  writableStr.push_back('\0');
+  globalParams->setTextEncoding(&writableStr.at(0));
+
+  if (recordFile.length() != 0)
+    return recordFixtures(recordFile, pages, dir);
+
+  std::vector<std::string> fixtures = listFixtures(dir);
+  if (fixtures.size() == 0) {
+    printf("No fixtures in %s, record some with --record\n", dir.c_str());
+    return 1;
+  }
+  Bench bench(minSeconds, minIterations, filter);
+  for (const std::string &name : fixtures) {
+    if (not benchFixture(bench, dir, name)) {
+      printf("Could not load the fixture %s\n", name.c_str());
+      return 1;
+    }
+  }
+  if (outputFile.length() != 0) {
+    std::ofstream output(outputFile.c_str());
+    bench.writeJSON(fixtures, output);
+    if (not output) {
+      printf("Could not write %s\n", outputFile.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "FigureBinary.h"
+
+void printUsage() {
+  printf("Usage: pdffigures-bin2json <file> [document#]\n");
+  printf("Lists the documents in a file written by pdffigures --save-binary, "
+         "or prints the figures of the given document (numbered from 0) as "
+         "JSON in the same format as pdffigures -j\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 or argc > 3) {
+    printUsage();
+    return 1;
+  }
+  FigureBinaryReader reader(argv[1]);
+  if (not reader.isOk()) {
+    printf("Could not read %s\n", argv[1]);
+    return 1;
+  }
+  if (argc == 2) {
+    for (int i = 0; i < reader.getNumDocuments(); ++i) {
+      printf("%d\t%d\t%s\n", i, reader.getNumFigures(i),
+             reader.getDocumentName(i).c_str());
+    }
+    return 0;
+  }
+  int document = std::stoi(argv[2]);
+  if (document < 0 or document >= reader.getNumDocuments()) {
+    printf("No document %d, %s has %d documents\n", document, argv[1],
+           reader.getNumDocuments());
+    return 1;
+  }
+  std::vector<FigureRecord> records = std::vector<FigureRecord>();
+  if (not reader.readFigures(document, records)) {
+    printf("Document %d is malformed\n", document);
+    return 1;
+  }
+  std::string buffer = "";
+  writeFigureRecordsJSON(records, buffer, std::cout);
+  return 0;
+}
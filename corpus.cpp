@@ -0,0 +1,669 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <PDFDocFactory.h>
+#include <GlobalParams.h>
+#include <getopt.h>
+
+#include "FigureRecord.h"
+
+namespace {
+
+/*
+  Reads the JSON pdffigures writes. Only keeps what the harness compares,
+  everything else is parsed and skipped.
+ */
+class JSONReader {
+public:
+  JSONReader(const std::string &text) : text(text), pos(0) {}
+
+  // Consumes c if it is the next character after any white space
+  bool consume(char c) {
+    skipSpace();
+    if (pos < text.size() and text[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  bool atEnd() {
+    skipSpace();
+    return pos == text.size();
+  }
+
+  bool readString(std::string &output) {
+    output.clear();
+    if (not consume('"'))
+      return false;
+    while (pos < text.size() and text[pos] != '"') {
+      if (text[pos] == '\\') {
+        if (pos + 1 >= text.size())
+          return false;
+        char c = text[pos + 1];
+        output += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+        // Unicode escapes are kept as they are, names are only compared
+        pos += 2;
+      } else {
+        output += text[pos++];
+      }
+    }
+    return consume('"');
+  }
+
+  bool readNumber(double &output) {
+    skipSpace();
+    const char *start = text.c_str() + pos;
+    char *end;
+    output = strtod(start, &end);
+    if (end == start)
+      return false;
+    pos += end - start;
+    return true;
+  }
+
+  bool readLiteral(const char *literal) {
+    skipSpace();
+    std::string value = literal;
+    if (text.compare(pos, value.size(), value) != 0)
+      return false;
+    pos += value.size();
+    return true;
+  }
+
+  bool skipValue() {
+    std::string ignored;
+    double number;
+    skipSpace();
+    if (pos >= text.size())
+      return false;
+    char c = text[pos];
+    if (c == '"')
+      return readString(ignored);
+    if (c == '[' or c == '{') {
+      char close = c == '[' ? ']' : '}';
+      ++pos;
+      if (consume(close))
+        return true;
+      do {
+        if (c == '{' and (not readString(ignored) or not consume(':')))
+          return false;
+        if (not skipValue())
+          return false;
+      } while (consume(','));
+      return consume(close);
+    }
+    return readLiteral("null") or readLiteral("true") or
+           readLiteral("false") or readNumber(number);
+  }
+
+private:
+  void skipSpace() {
+    while (pos < text.size() and isspace((unsigned char)text[pos]))
+      ++pos;
+  }
+
+  const std::string &text;
+  size_t pos;
+};
+
+class FigureBox {
+public:
+  FigureBox() : type(""), page(0), dpi(0), hasImage(false), bb{0, 0, 0, 0} {}
+
+  std::string type;
+  int page;
+  double dpi;
+  bool hasImage;
+  // x1, y1, x2, y2 at dpi
+  double bb[4];
+};
+
+// Reads figures from the output of pdffigures -j, returns false on malformed
+// input
+bool readFigureBoxes(const std::string &text, std::vector<FigureBox> &figures) {
+  JSONReader reader(text);
+  if (not reader.consume('['))
+    return false;
+  if (reader.consume(']'))
+    return reader.atEnd();
+  do {
+    FigureBox fig;
+    if (not reader.consume('{'))
+      return false;
+    if (not reader.consume('}')) {
+      do {
+        std::string key;
+        double value;
+        if (not reader.readString(key) or not reader.consume(':'))
+          return false;
+        bool ok = true;
+        if (key == "Type") {
+          ok = reader.readString(fig.type);
+        } else if (key == "Page") {
+          ok = reader.readNumber(value);
+          fig.page = (int)value;
+        } else if (key == "DPI") {
+          ok = reader.readNumber(fig.dpi);
+        } else if (key == "ImageBB" and not reader.readLiteral("null")) {
+          ok = reader.consume('[');
+          for (int i = 0; i < 4 and ok; ++i) {
+            ok = reader.readNumber(fig.bb[i]) and
+                 (i == 3 or reader.consume(','));
+          }
+          ok = ok and reader.consume(']');
+          fig.hasImage = true;
+        } else if (key != "ImageBB") {
+          ok = reader.skipValue();
+        }
+        if (not ok)
+          return false;
+      } while (reader.consume(','));
+      if (not reader.consume('}'))
+        return false;
+    }
+    figures.push_back(fig);
+  } while (reader.consume(','));
+  return reader.consume(']') and reader.atEnd();
+}
+
+// Reads the numbers of a JSON object, other values are skipped
+bool readNumbers(const std::string &text,
+                 std::map<std::string, double> &values) {
+  JSONReader reader(text);
+  if (not reader.consume('{'))
+    return false;
+  if (reader.consume('}'))
+    return true;
+  do {
+    std::string key;
+    double value;
+    if (not reader.readString(key) or not reader.consume(':'))
+      return false;
+    if (reader.readNumber(value))
+      values[key] = value;
+    else if (not reader.skipValue())
+      return false;
+  } while (reader.consume(','));
+  return reader.consume('}');
+}
+
+bool readFile(const std::string &name, std::string &contents) {
+  std::ifstream input(name.c_str(), std::ios::binary);
+  if (not input)
+    return false;
+  std::ostringstream buffer;
+  buffer << input.rdbuf();
+  contents = buffer.str();
+  return true;
+}
+
+// Intersection over union of the image regions of two figures, with other's
+// region scaled to fig's DPI
+double getIoU(const FigureBox &fig, const FigureBox &other) {
+  double scale = other.dpi > 0 and fig.dpi > 0 ? fig.dpi / other.dpi : 1;
+  double x1 = std::max(fig.bb[0], other.bb[0] * scale);
+  double y1 = std::max(fig.bb[1], other.bb[1] * scale);
+  double x2 = std::min(fig.bb[2], other.bb[2] * scale);
+  double y2 = std::min(fig.bb[3], other.bb[3] * scale);
+  double overlap = std::max(x2 - x1, 0.0) * std::max(y2 - y1, 0.0);
+  double area = (fig.bb[2] - fig.bb[0]) * (fig.bb[3] - fig.bb[1]);
+  double otherArea = (other.bb[2] - other.bb[0]) *
+                     (other.bb[3] - other.bb[1]) * scale * scale;
+  double total = area + otherArea - overlap;
+  return total <= 0 ? 0 : overlap / total;
+}
+
+// Number of golden figures matched by a found figure of the same type on the
+// same page whose region has at least minIoU with it. Each found figure
+// matches at most one golden figure, best matches are taken first.
+int countMatches(const std::vector<FigureBox> &found,
+                 const std::vector<FigureBox> &golden, double minIoU) {
+  std::vector<std::pair<double, std::pair<int, int>>> candidates =
+      std::vector<std::pair<double, std::pair<int, int>>>();
+  for (size_t i = 0; i < found.size(); ++i) {
+    for (size_t j = 0; j < golden.size(); ++j) {
+      if (found[i].page != golden[j].page or found[i].type != golden[j].type)
+        continue;
+      double iou = getIoU(found[i], golden[j]);
+      if (iou >= minIoU)
+        candidates.push_back(std::make_pair(iou, std::make_pair(i, j)));
+    }
+  }
+  std::sort(candidates.rbegin(), candidates.rend());
+  std::vector<bool> foundUsed = std::vector<bool>(found.size(), false);
+  std::vector<bool> goldenUsed = std::vector<bool>(golden.size(), false);
+  int matches = 0;
+  for (auto &candidate : candidates) {
+    int i = candidate.second.first, j = candidate.second.second;
+    if (foundUsed[i] or goldenUsed[j])
+      continue;
+    foundUsed[i] = true;
+    goldenUsed[j] = true;
+    matches += 1;
+  }
+  return matches;
+}
+
+// Only figures with a region can be compared
+std::vector<FigureBox> withImages(const std::vector<FigureBox> &figures) {
+  std::vector<FigureBox> kept = std::vector<FigureBox>();
+  for (const FigureBox &fig : figures) {
+    if (fig.hasImage)
+      kept.push_back(fig);
+  }
+  return kept;
+}
+
+/*
+  Runs pdffigures on pdf with flags, saving its JSON output to jsonPrefix.
+  Sets seconds to the wall time of the run and peakRSS to the largest resident
+  set size of the process in bytes. Returns the exit status, or -1 if
+  pdffigures could not be run or was killed, for example by the timeout.
+ */
+int runPdffigures(const std::string &binary,
+                  const std::vector<std::string> &flags, const std::string &pdf,
+                  const std::string &jsonPrefix, int timeout, bool verbose,
+                  double *seconds, long *peakRSS) {
+  std::vector<std::string> args = std::vector<std::string>();
+  args.push_back(binary);
+  args.insert(args.end(), flags.begin(), flags.end());
+  args.push_back("-j");
+  args.push_back(jsonPrefix);
+  args.push_back(pdf);
+  std::vector<char *> argv = std::vector<char *>();
+  for (std::string &arg : args)
+    argv.push_back(&arg.at(0));
+  argv.push_back(NULL);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    if (not verbose) {
+      int devNull = open("/dev/null", O_WRONLY);
+      dup2(devNull, STDOUT_FILENO);
+      dup2(devNull, STDERR_FILENO);
+    }
+    // The default action of SIGALRM ends the process, the alarm is kept
+    // across exec
+    if (timeout > 0)
+      alarm(timeout);
+    execv(binary.c_str(), argv.data());
+    _exit(127);
+  }
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0)
+    return -1;
+  *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start).count();
+  // In kilobytes on Linux
+  *peakRSS = usage.ru_maxrss * 1024L;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Nearest rank percentile of sorted values
+double getPercentile(const std::vector<double> &sorted, double percentile) {
+  if (sorted.size() == 0)
+    return 0;
+  size_t rank = (size_t)std::ceil(percentile / 100 * sorted.size());
+  return sorted.at(std::max(rank, (size_t)1) - 1);
+}
+
+// Totals over the corpus, written as one JSON object that can be saved as
+// the baseline of later runs
+class Summary {
+public:
+  Summary()
+      : documents(0), failures(0), pages(0), seconds(0), peakRSS(0),
+        figures(0), predicted(0), golden(0), matched(0),
+        latencies(std::vector<double>()) {}
+
+  double getPagesPerSecond() { return seconds == 0 ? 0 : pages / seconds; }
+
+  double getPrecision() {
+    return predicted == 0 ? 1 : matched / (double)predicted;
+  }
+
+  double getRecall() { return golden == 0 ? 1 : matched / (double)golden; }
+
+  void writeJSON(std::ostream &output) {
+    std::sort(latencies.begin(), latencies.end());
+    output << "{\"Documents\": " << documents << ", \"Failures\": " << failures
+           << ", \"Pages\": " << pages << ", \"Seconds\": " << seconds
+           << ", \"PagesPerSecond\": " << getPagesPerSecond()
+           << ", \"LatencyP50\": " << getPercentile(latencies, 50)
+           << ", \"LatencyP90\": " << getPercentile(latencies, 90)
+           << ", \"LatencyP99\": " << getPercentile(latencies, 99)
+           << ", \"LatencyMax\": " << getPercentile(latencies, 100)
+           << ", \"PeakRSS\": " << peakRSS << ", \"Figures\": " << figures;
+    // Accuracy is only known for documents with goldens
+    if (golden + predicted != 0) {
+      output << ", \"Predicted\": " << predicted << ", \"Golden\": " << golden
+             << ", \"Matched\": " << matched
+             << ", \"Precision\": " << getPrecision()
+             << ", \"Recall\": " << getRecall();
+    }
+    output << "}\n";
+  }
+
+  int documents;
+  int failures;
+  // Counted over documents that did not fail, a document that fails fast
+  // would make throughput look better
+  long pages;
+  double seconds;
+  long peakRSS;
+  long figures;
+  // Counted over documents with goldens only
+  long predicted;
+  long golden;
+  long matched;
+  // Seconds per document
+  std::vector<double> latencies;
+};
+
+// Prints each measure that regressed compared to baseline by more than the
+// tolerances, returns the number of regressions
+int compareToBaseline(Summary &summary,
+                      const std::map<std::string, double> &baseline,
+                      double speedTolerance, double accuracyTolerance) {
+  int regressions = 0;
+  // Baselines without failures are held to none
+  auto found = baseline.find("Failures");
+  int allowedFailures = found == baseline.end() ? 0 : (int)found->second;
+  if (summary.failures > allowedFailures) {
+    printf("Failures increased: %d documents failed, baseline %d\n",
+           summary.failures, allowedFailures);
+    regressions += 1;
+  }
+  found = baseline.find("PagesPerSecond");
+  if (found != baseline.end() and
+      summary.getPagesPerSecond() < found->second * (1 - speedTolerance)) {
+    printf("Throughput regressed: %.3f pages/sec, baseline %.3f\n",
+           summary.getPagesPerSecond(), found->second);
+    regressions += 1;
+  }
+  if (summary.golden + summary.predicted == 0)
+    return regressions;
+  found = baseline.find("Precision");
+  if (found != baseline.end() and
+      summary.getPrecision() < found->second - accuracyTolerance) {
+    printf("Precision regressed: %.4f, baseline %.4f\n",
+           summary.getPrecision(), found->second);
+    regressions += 1;
+  }
+  found = baseline.find("Recall");
+  if (found != baseline.end() and
+      summary.getRecall() < found->second - accuracyTolerance) {
+    printf("Recall regressed: %.4f, baseline %.4f\n", summary.getRecall(),
+           found->second);
+    regressions += 1;
+  }
+  return regressions;
+}
+
+// Names of the PDFs in dir, sorted
+std::vector<std::string> listDocuments(const std::string &dir) {
+  std::vector<std::string> names = std::vector<std::string>();
+  DIR *listing = opendir(dir.c_str());
+  if (listing == NULL)
+    return names;
+  dirent *entry;
+  while ((entry = readdir(listing)) != NULL) {
+    std::string file = entry->d_name;
+    if (file.size() > 4 and file.substr(file.size() - 4) == ".pdf")
+      names.push_back(file.substr(0, file.size() - 4));
+  }
+  closedir(listing);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+void printUsage() {
+  printf("Usage: pdffigures-corpus [flags] <corpus directory>\n");
+  printf("Runs pdffigures on each PDF in the directory, one at a time, and "
+         "reports its throughput, latency and memory use. Figures are "
+         "compared with <name>.json next to <name>.pdf when it exists, which "
+         "holds the expected figures in the format of pdffigures -j\n");
+  printf("-x, --pdffigures <path>: pdffigures binary to run, default "
+         "./pdffigures\n");
+  printf("-f, --flags <flags>: Space separated flags to pass to pdffigures\n");
+  printf("-o, --output <file>: Save a JSON line for each document followed "
+         "by the totals\n");
+  printf("-b, --baseline <file>: Fail if more documents failed, or "
+         "throughput or accuracy regressed, compared to the totals saved in "
+         "file\n");
+  printf("-s, --save-baseline <file>: Save the totals to file\n");
+  printf("--speed-tolerance <fraction>: Allowed drop in pages per second, "
+         "default 0.1\n");
+  printf("--accuracy-tolerance <fraction>: Allowed drop in precision or "
+         "recall, default 0.01\n");
+  printf("--iou <fraction>: Intersection over union a figure's region needs "
+         "with the expected region to match it, default 0.5\n");
+  printf("-t, --timeout <seconds>: Stop pdffigures after this long and count "
+         "the document as failed, default 300\n");
+  printf("-v, --verbose: Show the output of pdffigures\n");
+  printf("-h, --help show usage\n");
+}
+
+} // end namespace
+
+int main(int argc, char **argv) {
+  enum { SPEED_TOLERANCE = 256, ACCURACY_TOLERANCE, IOU };
+  static struct option long_options[] = {
+      {"pdffigures", required_argument, NULL, 'x'},
+      {"flags", required_argument, NULL, 'f'},
+      {"output", required_argument, NULL, 'o'},
+      {"baseline", required_argument, NULL, 'b'},
+      {"save-baseline", required_argument, NULL, 's'},
+      {"speed-tolerance", required_argument, NULL, SPEED_TOLERANCE},
+      {"accuracy-tolerance", required_argument, NULL, ACCURACY_TOLERANCE},
+      {"iou", required_argument, NULL, IOU},
+      {"timeout", required_argument, NULL, 't'},
+      {"verbose", no_argument, NULL, 'v'},
+      {"help", no_argument, NULL, 'h'},
+      {0, 0, 0, 0}};
+
+  std::string binary = "./pdffigures";
+  std::vector<std::string> flags = std::vector<std::string>();
+  std::string outputFile = "";
+  std::string baselineFile = "";
+  std::string saveBaselineFile = "";
+  double speedTolerance = 0.1;
+  double accuracyTolerance = 0.01;
+  double minIoU = 0.5;
+  int timeout = 300;
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "x:f:o:b:s:t:vh", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'x':
+      binary = optarg;
+      break;
+    case 'f': {
+      std::istringstream list(optarg);
+      std::string flag;
+      while (list >> flag)
+        flags.push_back(flag);
+      break;
+    }
+    case 'o':
+      outputFile = optarg;
+      break;
+    case 'b':
+      baselineFile = optarg;
+      break;
+    case 's':
+      saveBaselineFile = optarg;
+      break;
+    case SPEED_TOLERANCE:
+      speedTolerance = std::atof(optarg);
+      break;
+    case ACCURACY_TOLERANCE:
+      accuracyTolerance = std::atof(optarg);
+      break;
+    case IOU:
+      minIoU = std::atof(optarg);
+      break;
+    case 't':
+      timeout = std::atoi(optarg);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    case 'h':
+      printUsage();
+      return 0;
+    default:
+      printUsage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    printUsage();
+    return 1;
+  }
+  std::string dir = argv[optind];
+  std::vector<std::string> documents = listDocuments(dir);
+  if (documents.size() == 0) {
+    printf("No PDFs in %s\n", dir.c_str());
+    return 1;
+  }
+
+  std::map<std::string, double> baseline = std::map<std::string, double>();
+  if (baselineFile.length() != 0) {
+    std::string text;
+    if (not readFile(baselineFile, text)) {
+      printf("No baseline at %s, save one with --save-baseline\n",
+             baselineFile.c_str());
+    } else if (not readNumbers(text, baseline)) {
+      printf("Could not read the baseline %s\n", baselineFile.c_str());
+      return 1;
+    }
+  }
+
+  std::ofstream output;
+  if (outputFile.length() != 0) {
+    output.open(outputFile.c_str());
+    if (not output) {
+      printf("Could not open %s\n", outputFile.c_str());
+      return 1;
+    }
+  }
+
+  char tempTemplate[] = "/tmp/pdffigures-corpus-XXXXXX";
+  if (mkdtemp(tempTemplate) == NULL) {
+    printf("Could not create a temporary directory\n");
+    return 1;
+  }
+  std::string jsonPrefix = std::string(tempTemplate) + "/figures";
+
+  globalParams = new GlobalParams(); // Set up poppler, to count pages
+  Summary summary;
+  std::string escaped = "";
+  for (const std::string &name : documents) {
+    std::string pdf = dir + "/" + name + ".pdf";
+    std::unique_ptr<PDFDoc> doc(
+        PDFDocFactory().createPDFDoc(GooString(pdf.c_str()), NULL, NULL));
+    int pages = doc->isOk() ? doc->getNumPages() : 0;
+    doc.reset();
+
+    double seconds = 0;
+    long peakRSS = 0;
+    int status = runPdffigures(binary, flags, pdf, jsonPrefix, timeout,
+                               verbose, &seconds, &peakRSS);
+    std::string text;
+    std::vector<FigureBox> found = std::vector<FigureBox>();
+    bool failed = status != 0 or not readFile(jsonPrefix + ".json", text) or
+                  not readFigureBoxes(text, found);
+    unlink((jsonPrefix + ".json").c_str());
+    int figures = found.size();
+
+    summary.documents += 1;
+    summary.failures += failed;
+    if (not failed) {
+      summary.pages += pages;
+      summary.seconds += seconds;
+    }
+    summary.peakRSS = std::max(summary.peakRSS, peakRSS);
+    summary.figures += figures;
+    summary.latencies.push_back(seconds);
+
+    std::vector<FigureBox> golden = std::vector<FigureBox>();
+    bool hasGolden = readFile(dir + "/" + name + ".json", text);
+    if (hasGolden and not readFigureBoxes(text, golden)) {
+      printf("Could not read the expected figures of %s\n", name.c_str());
+      rmdir(tempTemplate);
+      return 1;
+    }
+    int matched = 0;
+    if (hasGolden) {
+      found = withImages(found);
+      golden = withImages(golden);
+      matched = countMatches(found, golden, minIoU);
+      summary.predicted += found.size();
+      summary.golden += golden.size();
+      summary.matched += matched;
+    }
+
+    printf("%-40s %4d pages %8.3f s %6ld MB", name.c_str(), pages, seconds,
+           peakRSS / (1024 * 1024));
+    if (failed)
+      printf(" failed (%d)", status);
+    else if (hasGolden)
+      printf(" matched %d of %d, %d found", matched, (int)golden.size(),
+             (int)found.size());
+    printf("\n");
+    if (output.is_open()) {
+      escaped.clear();
+      appendJSONEscaped(name.data(), name.size(), escaped);
+      output << "{\"Document\": \"" << escaped << "\", \"Pages\": " << pages
+             << ", \"Seconds\": " << seconds << ", \"PeakRSS\": " << peakRSS
+             << ", \"ExitStatus\": " << status
+             << ", \"Figures\": " << figures;
+      if (hasGolden)
+        output << ", \"Golden\": " << golden.size()
+               << ", \"Matched\": " << matched;
+      output << "}\n";
+    }
+  }
+  rmdir(tempTemplate);
+
+  summary.writeJSON(std::cout);
+  if (output.is_open())
+    summary.writeJSON(output);
+  if (saveBaselineFile.length() != 0) {
+    std::ofstream saved(saveBaselineFile.c_str());
+    summary.writeJSON(saved);
+    if (not saved) {
+      printf("Could not write %s\n", saveBaselineFile.c_str());
+      return 1;
+    }
+  }
+  if (compareToBaseline(summary, baseline, speedTolerance,
+                        accuracyTolerance) != 0)
+    return 2;
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+void printUsage() {
+  printf("Usage: pdffigures-merge <output> <file>...\n");
+  printf("Merges the -j output of pdffigures runs over disjoint pages of the "
+         "same document, for example runs with --load-analysis and different "
+         "--page-range, into one JSON file. Give the files in page order to "
+         "get the same output as a single run over all of the pages\n");
+}
+
+// Sets records to the text between the brackets of the JSON array in text,
+// without surrounding white space. Returns false if text is not an array.
+bool getRecords(const std::string &text, std::string &records) {
+  size_t start = text.find_first_not_of(" \t\r\n");
+  size_t end = text.find_last_not_of(" \t\r\n");
+  if (start == std::string::npos or text[start] != '[' or text[end] != ']' or
+      start == end)
+    return false;
+  records = text.substr(start + 1, end - start - 1);
+  size_t first = records.find_first_not_of(" \t\r\n");
+  if (first == std::string::npos) {
+    records = "";
+    return true;
+  }
+  records = records.substr(first,
+                           records.find_last_not_of(" \t\r\n") - first + 1);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printUsage();
+    return 1;
+  }
+  // Same layout as pdffigures' -j output: one record per line, separated by
+  // commas
+  std::string merged = "[\n";
+  bool empty = true;
+  for (int i = 2; i < argc; ++i) {
+    std::ifstream input(argv[i]);
+    if (not input) {
+      printf("Could not read %s\n", argv[i]);
+      return 1;
+    }
+    std::ostringstream text;
+    text << input.rdbuf();
+    std::string records;
+    if (not getRecords(text.str(), records)) {
+      printf("%s is not the JSON output of pdffigures\n", argv[i]);
+      return 1;
+    }
+    if (records.length() == 0)
+      continue;
+    if (not empty)
+      merged += ",\n";
+    merged += records;
+    empty = false;
+  }
+  merged += empty ? "]\n" : "\n]\n";
+  std::ofstream output(argv[1]);
+  output << merged;
+  output.close();
+  if (not output) {
+    printf("Could not write %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
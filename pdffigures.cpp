@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <sstream>
+#include <limits>
+#include <functional>
 
 #include <PDFDocFactory.h>
 #include <GlobalParams.h>
@@ -12,9 +16,36 @@
 #include "PDFUtils.h"
 #include "ExtractRegions.h"
 #include "ExtractFigures.h"
+#include "ResultCache.h"
+#include "FigureBinary.h"
+#include "Profiler.h"
+#include "PixPool.h"
 
 const std::string version = "1.0.6";
 
+// Key of the cached results of a page, analysisKey covers the document level
+// statistics and options, the caption starts found by the document level
+// analysis are included as well
+std::string getPageCacheKey(uint64_t fingerprint,
+                            const std::string &analysisKey,
+                            const std::vector<CaptionStart> &starts) {
+  std::ostringstream key;
+  key.precision(std::numeric_limits<double>::max_digits10);
+  key << analysisKey;
+  for (const CaptionStart &start : starts) {
+    double xMin, yMin, xMax, yMax;
+    start.word->getBBox(&xMin, &yMin, &xMax, &yMax);
+    key << start.number << " " << start.type << " " << xMin << " " << yMin
+        << " " << xMax << " " << yMax << "\n";
+  }
+  std::string keyStr = key.str();
+  char name[33];
+  snprintf(name, sizeof(name), "%016llx%016llx",
+           (unsigned long long)fingerprint,
+           (unsigned long long)hashBytes(keyStr.data(), keyStr.size()));
+  return name;
+}
+
 void printUsage() {
   printf("Usage: figureextractor [flags] </path/to/pdf>\n");
   printf("--version\n");
@@ -31,10 +62,101 @@ void printUsage() {
          "prefix. Files are save to prefix-<(Table|Figure)>-<Number>.png\n");
   printf("-c, --save-color-images <prefix>: Save color images with a high resolution for figures and tables."
     "Files are save to prefix-<(Table|Figure)>-c<Number>.png\n");
+  printf("--save-vector <prefix>: Save each figure as a single page PDF "
+         "cropped to the figure, keeping the page's vector graphics. Files are "
+         "saved to prefix-<(Table|Figure)>-<Number>.pdf\n");
   printf("-j, --save-json <prefix>: Save json encoding of detected figures to "
          "prefix. Files are save to prefix.json\n");
+  printf("--save-ndjson <file>: Save figures to file as newline delimited "
+         "JSON, one record per figure with the same fields as -j. Records are "
+         "written as soon as each page is done, and the last line is a record "
+         "with Type \"Summary\" giving the number of pages in the document "
+         "(Pages), pages processed (PagesProcessed), and figures "
+         "(Figures).\n");
+  printf("--save-binary <file>: Append the figures found to file in a compact "
+         "binary format (see FigureBinary.h). Many documents can be appended "
+         "to the same file, use pdffigures-bin2json to convert them to JSON. "
+         "Not used with --cache\n");
+  printf("--native-images: With -c, save figures that are a single embedded "
+         "image as that image at its own resolution instead of cropping a "
+         "high resolution render. JPEG images are saved as is with a .jpg "
+         "extension, other images are decoded. Pages where every figure is "
+         "saved this way are not rendered\n");
+  printf("--thumbnails <size,size,...>: Also save each image written by -o "
+         "and -c scaled down so its longest side is at most size pixels, to "
+         "<name>-<size>.<ext>. Images smaller than size are saved as is\n");
+  printf("--archive <file>: Append the images saved with -o, -c and -a to a "
+         "tar archive instead of writing one file per image. The archive is "
+         "appended to if it exists, so many documents can share one. Members "
+         "are named like the files they replace, and -j and --save-ndjson "
+         "records list the Name, Offset and Length of each figure's images "
+         "so they can be read by seeking into the archive. Not used with "
+         "--cache\n");
+  printf("--profile <file>: Save the wall and CPU time spent in each stage, "
+         "and counts of pages rendered, figure proposals and configurations "
+         "evaluated, for the document and for each page to file as JSON\n");
+  printf("--trace <file>: Save a trace of the document, each page and each "
+         "stage, including the encoding and writing done on the writer "
+         "threads, to file in the Chrome trace event format (for "
+         "chrome://tracing or Perfetto). Traces of runs on the same host use "
+         "the same clock and can be viewed together\n");
+  printf("--memory-report <file>: Track the bytes of image data each stage "
+         "allocates and keeps, and the resident set size around each stage "
+         "and page, and save them to file as JSON. Pages that keep image "
+         "memory allocated after they are done are listed as GrowingPages\n");
+  printf("--pix-pool <MB>: Keep up to MB of freed image buffers to be reused "
+         "by later pages instead of returning them to the system (default "
+         "256, 0 disables). With --verbose the number of allocations that "
+         "reused a buffer is printed, --memory-report also includes it\n");
+  printf("--fsync <none|each|batch>: When to fsync the image and JSON files "
+         "written: never (the default), after each file, or for all files "
+         "once the document is done. The exit status is non-zero if any "
+         "output could not be written\n");
+  printf("--image-format <png|jpg|webp>: Format of the images saved with -o "
+         "and -c, files get the matching extension. webp needs leptonica to be "
+         "built with libwebp\n");
+  printf("--png-level <0-9>: zlib compression level for PNG images, lower is "
+         "faster and larger\n");
+  printf("--image-quality <1-100>: Quality of JPEG and WebP images (default "
+         "90)\n");
+  printf("--writer-threads <n>: Number of threads encoding and writing images "
+         "(default 2)\n");
   printf("-r, --reverse: Go through pages in reverse order\n");
   printf("-p, --page <page#>: Run only for the given page\n");
+  printf("--page-range <first>-<last>: Run only for pages first to last "
+         "(inclusive), pages are numbered as for --page\n");
+  printf("--save-analysis <file>: Save the document level statistics and "
+         "caption locations to file. If no other output is requested "
+         "pdffigures stops after saving\n");
+  printf("--load-analysis <file>: Load document level statistics and caption "
+         "locations saved with --save-analysis instead of analyzing the whole "
+         "document, only the text of the selected pages is extracted. The "
+         "-j output of runs over disjoint page ranges can be merged with "
+         "pdffigures-merge\n");
+  printf("--cache <dir>: Cache results in dir keyed by the contents of the "
+         "PDF and the options used, repeated runs on the same document copy "
+         "the cached output instead of processing it again. Not used with "
+         "-s, -f, the analysis options, --profile, --trace or "
+         "--memory-report\n");
+  printf("--cache-size <MB>: Evict least recently used cache entries once "
+         "the cache is larger than this\n");
+  printf("--incremental: With --cache, also cache the results of each page "
+         "keyed by a fingerprint of the page's contents and resources. When a "
+         "revised version of a document is processed, pages that did not "
+         "change are reused as long as the document statistics they depend on "
+         "are the same\n");
+  printf("--sample-pages <n>: With -p or --page-range, build the document "
+         "statistics and find captions using only n evenly spaced pages plus "
+         "the selected ones, so the cost does not grow with the length of the "
+         "document. Results can differ from a full run, see README.md\n");
+  printf("--check-sampling: With --sample-pages, also analyze the whole "
+         "document and report how the sampled statistics and captions on the "
+         "selected pages differ from the full ones\n");
+  printf("--captions-only: Only locate captions, the JSON output has an entry "
+         "for each caption with a null ImageBB. Pages are never rendered, "
+         "graphical elements that captions should not cross are taken from "
+         "the page's drawing operations instead. Cannot be combined with "
+         "-s, -f, -a, -o or -c\n");
   printf("-i, --text-as-image: Attempt to parse documents even if the "
          "document's text is encoded as part of an embedded image (usually "
          "caused by scanned documents that have been processed with OCR). "
@@ -54,10 +176,41 @@ int main(int argc, char **argv) {
   std::string imagePrefix = "";
   std::string colorImagePrefix = "";
   std::string jsonPrefix = "";
+  std::string ndjsonFile = "";
+  std::string binaryFile = "";
+  std::string archiveFile = "";
+  std::string vectorPrefix = "";
+  std::string profileFile = "";
+  std::string traceFile = "";
+  std::string memoryFile = "";
   std::string finalPrefix = "";
+  std::string saveAnalysis = "";
+  std::string loadAnalysis = "";
+  int firstPage = -1;
+  int lastPage = -1;
+  std::string cacheDir = "";
+  long long cacheSize = 0;
+  int incremental = false;
+  int captionsOnly = false;
+  int samplePages = 0;
+  int checkSampling = false;
+  int nativeImages = false;
+  OutputWriter::SyncPolicy syncPolicy = OutputWriter::SYNC_NONE;
+  ImageFormat imageFormat = ImageFormat();
+  int writerThreads = 2;
+  long long pixPoolSize = 256;
+  // Sizes of the thumbnails to save, largest first
+  std::vector<int> thumbnails = std::vector<int>();
   const double resolution = 100;
   const int resMultiply = 4; 
 
+  // Options that only have a long form
+  enum { SAVE_ANALYSIS = 256, LOAD_ANALYSIS, PAGE_RANGE, CACHE, CACHE_SIZE,
+         INCREMENTAL, SAMPLE_PAGES, SAVE_NDJSON, SAVE_BINARY, FSYNC,
+         IMAGE_FORMAT, PNG_LEVEL, IMAGE_QUALITY, WRITER_THREADS, ARCHIVE,
+         THUMBNAILS, SAVE_VECTOR, SAVE_PROFILE,
+         SAVE_TRACE, MEMORY_REPORT, PIX_POOL };
+
   const struct option long_options[] = {
       {"version", no_argument, NULL, 0},
       {"verbose", no_argument, &verbose, true},
@@ -67,10 +220,34 @@ int main(int argc, char **argv) {
       {"save-figures", required_argument, NULL, 'o'},
       {"save-color-images", required_argument, NULL, 'c'},
       {"save-json", required_argument, NULL, 'j'},
+      {"save-ndjson", required_argument, NULL, SAVE_NDJSON},
+      {"save-binary", required_argument, NULL, SAVE_BINARY},
+      {"fsync", required_argument, NULL, FSYNC},
+      {"image-format", required_argument, NULL, IMAGE_FORMAT},
+      {"png-level", required_argument, NULL, PNG_LEVEL},
+      {"image-quality", required_argument, NULL, IMAGE_QUALITY},
+      {"writer-threads", required_argument, NULL, WRITER_THREADS},
+      {"archive", required_argument, NULL, ARCHIVE},
+      {"thumbnails", required_argument, NULL, THUMBNAILS},
+      {"save-vector", required_argument, NULL, SAVE_VECTOR},
+      {"profile", required_argument, NULL, SAVE_PROFILE},
+      {"trace", required_argument, NULL, SAVE_TRACE},
+      {"memory-report", required_argument, NULL, MEMORY_REPORT},
+      {"pix-pool", required_argument, NULL, PIX_POOL},
       {"page", required_argument, NULL, 'p'},
       {"reverse", no_argument, &reverse, 'r'},
       {"text-as-image", no_argument, &textAsImage, true},
       {"save-mistakes", no_argument, &saveMistakes, true},
+      {"save-analysis", required_argument, NULL, SAVE_ANALYSIS},
+      {"load-analysis", required_argument, NULL, LOAD_ANALYSIS},
+      {"page-range", required_argument, NULL, PAGE_RANGE},
+      {"cache", required_argument, NULL, CACHE},
+      {"cache-size", required_argument, NULL, CACHE_SIZE},
+      {"incremental", no_argument, &incremental, true},
+      {"captions-only", no_argument, &captionsOnly, true},
+      {"sample-pages", required_argument, NULL, SAMPLE_PAGES},
+      {"check-sampling", no_argument, &checkSampling, true},
+      {"native-images", no_argument, &nativeImages, true},
       {"help", no_argument, NULL, 'h'},
       {0, 0, 0, 0}};
 
@@ -115,6 +292,121 @@ int main(int argc, char **argv) {
     case 'i':
       textAsImage = true;
       break;
+    case SAVE_ANALYSIS:
+      saveAnalysis = optarg;
+      break;
+    case LOAD_ANALYSIS:
+      loadAnalysis = optarg;
+      break;
+    case PAGE_RANGE: {
+      std::string range = optarg;
+      size_t split = range.find('-');
+      if (split == std::string::npos or split == 0 or
+          split == range.length() - 1) {
+        printf("Page range should be given as <first>-<last>\n");
+        return 1;
+      }
+      firstPage = std::stoi(range.substr(0, split));
+      lastPage = std::stoi(range.substr(split + 1));
+      break;
+    }
+    case CACHE:
+      cacheDir = optarg;
+      break;
+    case CACHE_SIZE:
+      cacheSize = std::stoll(optarg) * 1024 * 1024;
+      break;
+    case FSYNC: {
+      std::string policy = optarg;
+      if (policy == "none") {
+        syncPolicy = OutputWriter::SYNC_NONE;
+      } else if (policy == "each") {
+        syncPolicy = OutputWriter::SYNC_EACH;
+      } else if (policy == "batch") {
+        syncPolicy = OutputWriter::SYNC_BATCH;
+      } else {
+        printf("--fsync should be one of none, each or batch\n");
+        return 1;
+      }
+      break;
+    }
+    case IMAGE_FORMAT: {
+      std::string format = optarg;
+      if (format == "png") {
+        imageFormat.format = IFF_PNG;
+      } else if (format == "jpg") {
+        imageFormat.format = IFF_JFIF_JPEG;
+      } else if (format == "webp") {
+        imageFormat.format = IFF_WEBP;
+      } else {
+        printf("--image-format should be one of png, jpg or webp\n");
+        return 1;
+      }
+      break;
+    }
+    case PNG_LEVEL:
+      imageFormat.pngLevel = std::stoi(optarg);
+      if (imageFormat.pngLevel < 0 or imageFormat.pngLevel > 9) {
+        printf("--png-level should be between 0 and 9\n");
+        return 1;
+      }
+      break;
+    case IMAGE_QUALITY:
+      imageFormat.quality = std::stoi(optarg);
+      if (imageFormat.quality < 1 or imageFormat.quality > 100) {
+        printf("--image-quality should be between 1 and 100\n");
+        return 1;
+      }
+      break;
+    case WRITER_THREADS:
+      writerThreads = std::max(std::stoi(optarg), 1);
+      break;
+    case ARCHIVE:
+      archiveFile = optarg;
+      break;
+    case SAVE_VECTOR:
+      vectorPrefix = optarg;
+      break;
+    case SAVE_PROFILE:
+      profileFile = optarg;
+      break;
+    case SAVE_TRACE:
+      traceFile = optarg;
+      break;
+    case MEMORY_REPORT:
+      memoryFile = optarg;
+      break;
+    case PIX_POOL:
+      pixPoolSize = std::stoll(optarg);
+      if (pixPoolSize < 0) {
+        printf("--pix-pool should not be negative\n");
+        return 1;
+      }
+      break;
+    case THUMBNAILS: {
+      std::istringstream sizes(optarg);
+      std::string size;
+      while (std::getline(sizes, size, ',')) {
+        thumbnails.push_back(std::stoi(size));
+        if (thumbnails.back() <= 0) {
+          printf("Thumbnail sizes should be positive\n");
+          return 1;
+        }
+      }
+      std::sort(thumbnails.begin(), thumbnails.end(), std::greater<int>());
+      thumbnails.erase(std::unique(thumbnails.begin(), thumbnails.end()),
+                       thumbnails.end());
+      break;
+    }
+    case SAVE_BINARY:
+      binaryFile = optarg;
+      break;
+    case SAVE_NDJSON:
+      ndjsonFile = optarg;
+      break;
+    case SAMPLE_PAGES:
+      samplePages = std::stoi(optarg);
+      break;
     case 'h':
       printUsage();
       return 0;
@@ -138,12 +430,117 @@ int main(int argc, char **argv) {
 
   if (not showFinal and not showSteps and finalPrefix.length() == 0 and
       not verbose and imagePrefix.length() == 0 and jsonPrefix.length() == 0 and
-      colorImagePrefix.length() == 0) {
+      colorImagePrefix.length() == 0 and saveAnalysis.length() == 0 and
+      ndjsonFile.length() == 0 and binaryFile.length() == 0 and
+      vectorPrefix.length() == 0 and profileFile.length() == 0 and
+      traceFile.length() == 0 and memoryFile.length() == 0) {
     printf("No output requested\n");
     printUsage();
     return 1;
   }
 
+  if (captionsOnly and (showFinal or showSteps or finalPrefix.length() != 0 or
+                       imagePrefix.length() != 0 or
+                       colorImagePrefix.length() != 0 or
+                       vectorPrefix.length() != 0)) {
+    printf("--captions-only does not render pages so it cannot be combined "
+           "with image output\n");
+    return 1;
+  }
+
+#ifndef PROFILE
+  if (profileFile.length() != 0 or traceFile.length() != 0 or
+      memoryFile.length() != 0) {
+    printf("--profile, --trace and --memory-report need pdffigures to be "
+           "built with PROFILE=1\n");
+    return 1;
+  }
+#endif
+
+  bool sampling = samplePages > 0 and (onlyPage >= 0 or firstPage >= 0);
+  if (sampling and
+      (saveAnalysis.length() != 0 or loadAnalysis.length() != 0)) {
+    printf("--sample-pages cannot be combined with --save-analysis or "
+           "--load-analysis\n");
+    return 1;
+  }
+
+  std::unique_ptr<ResultCache> cache;
+  // Appending to a binary file or archive is not an output that can be copied
+  // back, and profiles have to measure an actual run
+  if (cacheDir.length() != 0 and not showFinal and not showSteps and
+      saveAnalysis.length() == 0 and loadAnalysis.length() == 0 and
+      binaryFile.length() == 0 and archiveFile.length() == 0 and
+      profileFile.length() == 0 and traceFile.length() == 0 and
+      memoryFile.length() == 0) {
+    // Everything that can change what we output
+    std::ostringstream options;
+    options << "pdffigures " << version << " mistakes " << saveMistakes
+            << " text-as-image " << textAsImage << " reverse " << reverse
+            << " page " << onlyPage << " range " << firstPage << " "
+            << lastPage << " json " << (jsonPrefix.length() != 0)
+            << " figures " << (imagePrefix.length() != 0) << " color "
+            << (colorImagePrefix.length() != 0) << " final "
+            << (finalPrefix.length() != 0) << " captions-only "
+            << captionsOnly << " sample " << (sampling ? samplePages : 0)
+            << " ndjson " << (ndjsonFile.length() != 0) << " vector "
+            << (vectorPrefix.length() != 0) << " format "
+            << imageFormat.format << " " << imageFormat.pngLevel << " "
+            << imageFormat.quality << " native " << nativeImages
+            << " thumbnails";
+    for (int size : thumbnails)
+      options << " " << size;
+    cache.reset(new ResultCache(cacheDir, cacheSize));
+    if (cache->setKey(argv[optind], options.str())) {
+      cache->setPrefix("json", jsonPrefix);
+      cache->setPrefix("figures", imagePrefix);
+      cache->setPrefix("color", colorImagePrefix);
+      cache->setPrefix("final", finalPrefix);
+      cache->setPrefix("ndjson", ndjsonFile);
+      cache->setPrefix("vector", vectorPrefix);
+      if (cache->restore()) {
+        if (verbose)
+          printf("Restored results from %s\n", cacheDir.c_str());
+        return 0;
+      }
+    } else {
+      cache.reset();
+    }
+  }
+
+  // Before any PIX is allocated
+  if (pixPoolSize > 0 and not getPixPool().enable(pixPoolSize * 1024 * 1024)) {
+    printf("The PIX pool must be enabled before any PIX is allocated\n");
+    return 1;
+  }
+  if (memoryFile.length() != 0)
+    getProfiler().enableMemory();
+  if (traceFile.length() != 0)
+    getProfiler().enableTrace(argv[optind]);
+  else if (profileFile.length() != 0)
+    getProfiler().enable();
+  PROFILE_THREAD("main");
+  double documentStart = Profiler::getWallTime();
+  auto finishProfile = [&]() {
+    if (profileFile.length() != 0) {
+      std::ofstream output(profileFile.c_str());
+      getProfiler().writeJSON(output);
+    }
+    if (traceFile.length() != 0) {
+      getProfiler().addEvent("document", documentStart,
+                             Profiler::getWallTime());
+      std::ofstream output(traceFile.c_str());
+      getProfiler().writeTrace(output);
+    }
+    if (memoryFile.length() != 0) {
+      std::ofstream output(memoryFile.c_str());
+      int growing = getProfiler().writeMemoryJSON(output);
+      if (growing != 0)
+        printf("Warning: image memory grew on %d pages, see %s\n", growing,
+               memoryFile.c_str());
+    }
+  };
+
   globalParams = new GlobalParams(); // Set up poppler
   // Build a writable str to pass to setTextEncoding
   std::string str = "UTF-8";
@@ -157,23 +554,154 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  std::vector<TextPage *> pages = getTextPages(doc.get(), resolution);
+  std::ofstream ndjson;
+  int ndjsonPages = 0;
+  int ndjsonFigures = 0;
+  if (ndjsonFile.length() != 0) {
+    ndjson.open(ndjsonFile.c_str());
+    if (not ndjson) {
+      printf("Could not open %s\n", ndjsonFile.c_str());
+      return 1;
+    }
+  }
+  // Writes the summary record, files without one were cut short
+  auto finishNdjson = [&]() {
+    if (ndjsonFile.length() == 0)
+      return;
+    ndjson << "{\"Type\":\"Summary\",\"Pages\":" << doc->getNumPages()
+           << ",\"PagesProcessed\":" << ndjsonPages
+           << ",\"Figures\":" << ndjsonFigures << "}\n";
+    ndjson.close();
+    if (cache)
+      cache->addOutput("ndjson", ndjsonFile);
+  };
+
+  auto pageSelected = [&](int page) {
+    return (onlyPage < 0 or onlyPage == page) and
+           (firstPage < 0 or (firstPage <= page and page <= lastPage));
+  };
+
+  std::vector<TextPage *> pages;
+  std::unique_ptr<DocumentStatistics> docStats;
+  std::map<int, std::vector<CaptionStart>> captionStarts;
+  if (loadAnalysis.length() != 0) {
+    std::ifstream input(loadAnalysis.c_str());
+    docStats.reset(new DocumentStatistics(input));
+    if (not docStats->isOk() or
+        docStats->getNumPages() != doc->getNumPages()) {
+      printf("Could not load analysis for this document from %s\n",
+             loadAnalysis.c_str());
+      return 1;
+    }
+    // Only the text of the pages we are going to process is needed
+    pages = std::vector<TextPage *>(doc->getNumPages(), NULL);
+    for (int i = 0; i < doc->getNumPages(); ++i) {
+      if (pageSelected(i))
+        pages.at(i) = getTextPage(doc.get(), i + 1, resolution);
+    }
+    if (not readCaptionStarts(input, pages, captionStarts)) {
+      printf("Could not load caption locations from %s\n",
+             loadAnalysis.c_str());
+      return 1;
+    }
+  } else if (sampling) {
+    // Only extract the text of the selected pages and of evenly spaced
+    // samples of the rest of the document
+    int nPages = doc->getNumPages();
+    int nSamples = std::min(samplePages, nPages);
+    pages = std::vector<TextPage *>(nPages, NULL);
+    for (int i = 0; i < nPages; ++i) {
+      if (pageSelected(i))
+        pages.at(i) = getTextPage(doc.get(), i + 1, resolution);
+    }
+    for (int k = 0; k < nSamples; ++k) {
+      int i = (2 * k + 1) * nPages / (2 * nSamples);
+      if (pages.at(i) == NULL)
+        pages.at(i) = getTextPage(doc.get(), i + 1, resolution);
+    }
+    if (verbose)
+      printf("Scanned %d of %d pages\n",
+             (int)(nPages - std::count(pages.begin(), pages.end(),
+                                       (TextPage *)NULL)),
+             nPages);
+    docStats.reset(new DocumentStatistics(pages, doc.get(), verbose));
+    captionStarts = extractCaptionsFromText(pages, *docStats, verbose);
 
-  if (verbose)
-    printf("Scanned %d pages\n", (int)pages.size());
-  DocumentStatistics docStats = DocumentStatistics(pages, doc.get(), verbose);
+    if (checkSampling) {
+      std::vector<TextPage *> allPages = pages;
+      for (int i = 0; i < nPages; ++i) {
+        if (allPages.at(i) == NULL)
+          allPages.at(i) = getTextPage(doc.get(), i + 1, resolution);
+      }
+      DocumentStatistics fullStats(allPages, doc.get(), false);
+      std::map<int, std::vector<CaptionStart>> fullCaptionStarts =
+          extractCaptionsFromText(allPages, fullStats, false);
+      printf("Comparing full (first) and sampled (second) statistics:\n");
+      int differences = fullStats.printDifferences(*docStats);
+      int captionDifferences = 0;
+      for (int i = 0; i < nPages; ++i) {
+        if (not pageSelected(i))
+          continue;
+        std::vector<CaptionStart> full = std::vector<CaptionStart>();
+        std::vector<CaptionStart> sampled = std::vector<CaptionStart>();
+        if (fullCaptionStarts.find(i) != fullCaptionStarts.end())
+          full = fullCaptionStarts.at(i);
+        if (captionStarts.find(i) != captionStarts.end())
+          sampled = captionStarts.at(i);
+        bool same = full.size() == sampled.size();
+        for (size_t j = 0; same and j < full.size(); ++j) {
+          same = full[j].word == sampled[j].word and
+                 full[j].number == sampled[j].number and
+                 full[j].type == sampled[j].type;
+        }
+        if (not same) {
+          printf("Captions on page %d differ (%d full, %d sampled)\n", i,
+                 (int)full.size(), (int)sampled.size());
+          captionDifferences += 1;
+        }
+      }
+      printf("%d statistics differ, captions differ on %d selected pages\n",
+             differences, captionDifferences);
+      for (int i = 0; i < nPages; ++i) {
+        if (pages.at(i) == NULL)
+          allPages.at(i)->decRefCnt();
+      }
+    }
+  } else {
+    pages = getTextPages(doc.get(), resolution);
+    if (verbose)
+      printf("Scanned %d pages\n", (int)pages.size());
+    docStats.reset(new DocumentStatistics(pages, doc.get(), verbose));
+    captionStarts = extractCaptionsFromText(pages, *docStats, verbose);
+    if (saveAnalysis.length() != 0) {
+      std::ofstream output(saveAnalysis.c_str());
+      docStats->write(output);
+      writeCaptionStarts(captionStarts, pages, output);
+      output.close();
+      if (verbose)
+        printf("Saved analysis to %s\n", saveAnalysis.c_str());
+      if (not showFinal and not showSteps and finalPrefix.length() == 0 and
+          imagePrefix.length() == 0 and jsonPrefix.length() == 0 and
+          colorImagePrefix.length() == 0 and ndjsonFile.length() == 0 and
+          binaryFile.length() == 0 and vectorPrefix.length() == 0) {
+        finishProfile();
+        return 0;
+      }
+    }
+  }
 
-  if (docStats.isBodyTextGraphical() and not textAsImage) {
+  if (docStats->isBodyTextGraphical() and not textAsImage) {
     printf("Body text appears to be encoded as graphics, skipping (use -i to "
            "parse these kinds of documents)\n");
+    finishNdjson();
+    finishProfile();
+    if (cache)
+      cache->store();
     return 0;
   }
 
   std::vector<Figure> errors = std::vector<Figure>();
 
-  std::map<int, std::vector<CaptionStart>> captionStarts =
-      extractCaptionsFromText(pages, verbose);
-
   if (captionStarts.size() == 0) {
     printf("No captions found!");
     if (jsonPrefix.length() != 0) {
@@ -181,7 +709,19 @@ int main(int argc, char **argv) {
       std::ofstream output((jsonPrefix + ".json").c_str());
       output << "[]";
       output.close();
+      if (cache)
+        cache->addOutput("json", jsonPrefix + ".json");
     }
+    if (binaryFile.length() != 0 and
+        not appendFigureBinary(binaryFile, argv[optind],
+                               std::vector<FigureRecord>())) {
+      printf("Could not append figures to %s\n", binaryFile.c_str());
+      return 1;
+    }
+    finishNdjson();
+    finishProfile();
+    if (cache)
+      cache->store();
     return 0;
   }
 
@@ -196,6 +736,55 @@ int main(int argc, char **argv) {
     printf("\n");
   }
 
+  std::unique_ptr<PageFingerprinter> fingerprinter;
+  std::string analysisKey = "";
+  if (cache and incremental and not captionsOnly) {
+    fingerprinter.reset(new PageFingerprinter(doc.get()));
+    std::ostringstream key;
+    key << "pdffigures " << version << " mistakes " << saveMistakes
+        << " resolution " << resolution << "\n";
+    docStats->writePageAnalysisKey(key);
+    analysisKey = key.str();
+  }
+
+  // Images and JSON are written in the background, analysis of the next page
+  // continues while they are encoded
+  OutputWriter writer(writerThreads, 4 * writerThreads, syncPolicy);
+  if (archiveFile.length() != 0 and not writer.openArchive(archiveFile)) {
+    printf("Could not open %s as a tar archive\n", archiveFile.c_str());
+    return 1;
+  }
+  // Records where the images of fig ended up in the archive
+  auto addArchivedImages = [&](Figure &fig, FigureRecord &record) {
+    if (not writer.isArchiving())
+      return;
+    std::string prefixes[2] = {imagePrefix, colorImagePrefix};
+    std::vector<int> sizes = thumbnails;
+    sizes.insert(sizes.begin(), 0);
+    for (int color = 0; color < 2; ++color) {
+      if (prefixes[color].length() == 0)
+        continue;
+      for (int size : sizes) {
+        ImageRecord image;
+        image.name = getFigureImageName(prefixes[color], fig, color == 1,
+                                        imageFormat, size);
+        if (writer.getArchiveEntry(image.name, &image.offset, &image.length))
+          record.images.push_back(image);
+      }
+      // Native JPEG images keep their format
+      if (color == 1 and nativeImages and imageFormat.format != IFF_JFIF_JPEG) {
+        ImageRecord image;
+        ImageFormat jpeg = ImageFormat();
+        jpeg.format = IFF_JFIF_JPEG;
+        image.name = getFigureImageName(prefixes[color], fig, true, jpeg, 0);
+        if (writer.getArchiveEntry(image.name, &image.offset, &image.length))
+          record.images.push_back(image);
+      }
+    }
+  };
+  FigureRecordBuilder recordBuilder = FigureRecordBuilder(pages, resolution);
+  FigureRecord record = FigureRecord();
+  std::string jsonBuffer = "";
   std::vector<Figure> allFigures;
   std::map<int, std::pair<int, int>> pageSizes;
   std::map<int, std::vector<CaptionStart>>::iterator start =
@@ -210,107 +799,242 @@ int main(int argc, char **argv) {
       onPage = start->first;
       start++;
     }
-    if (onlyPage >= 0 and onlyPage != onPage)
+    if (not pageSelected(onPage))
       continue;
     if (verbose)
       printf("Working on page %d\n", onPage);
+    PROFILE_PAGE(onPage);
+    PROFILE_SPAN("page");
+    // Holds the leptonica objects the page's stages share, everything a
+    // figure keeps is referenced by the figure itself
+    LeptArena pageArena;
 
-    std::unique_ptr<PIX> fullRender =
-        getFullRenderPix(doc.get(), onPage + 1, resolution);
-    std::unique_ptr<PIX> fullRender1d(pixConvertTo1(fullRender.get(), 250));
-
-    std::unique_ptr<PIX> graphics1d;
-    if (not docStats.isBodyTextGraphical()) {
-      std::unique_ptr<PIX> graphics =
-          getGraphicOnlyPix(doc.get(), onPage + 1, resolution);
-      graphics1d = std::unique_ptr<PIX>(pixConvertTo1(graphics.get(), 250));
-    } else {
-      graphics1d = std::unique_ptr<PIX>(pixCreateTemplate(fullRender1d.get()));
-    }
-
-    // Remove graphical elements that did not show up in the original due
-    // to PDF shenanigans.
-    pixAnd(graphics1d.get(), graphics1d.get(), fullRender1d.get());
-
-    std::vector<Caption> captions =
-        buildCaptions(captionStarts.at(onPage), docStats, pages.at(onPage),
-                      graphics1d.get(), verbose);
-    PageRegions regions =
-        getPageRegions(fullRender1d.get(), pages.at(onPage), graphics1d.get(),
-                       captions, docStats, onPage, verbose, showSteps, errors);
-    std::vector<Figure> figures;
-    if (regions.captions.size() == 0) {
-      figures = std::vector<Figure>();
-    } else {
-      figures = extractFigures(fullRender1d.get(), regions, docStats, verbose,
-                               showSteps, errors);
+    std::vector<Figure> figures = std::vector<Figure>();
+    int pageWidth = 0;
+    int pageHeight = 0;
+    bool reused = false;
+    std::string pageKey = "";
+    if (fingerprinter) {
+      pageKey = getPageCacheKey(fingerprinter->getFingerprint(onPage + 1),
+                                analysisKey, captionStarts.at(onPage));
+      std::string data;
+      if (cache->lookupPage(pageKey, data)) {
+        std::istringstream input(data);
+        reused = (input >> pageWidth >> pageHeight) and
+                 readFigures(input, figures);
+        if (not reused)
+          figures.clear();
+        else if (verbose)
+          printf("Reusing cached results for page %d\n", onPage);
+        // The key does not include the page's position, the page may have
+        // moved if pages were inserted or removed in this revision
+        for (Figure &fig : figures)
+          fig.page = onPage;
+      }
     }
 
-    if (figures.size() == 0 and verbose) {
-      printf("Warning: No figures recovered");
-    }
+    PixPtr fullRender;
+    if (captionsOnly) {
+      getPageSize(doc.get(), onPage + 1, resolution, &pageWidth, &pageHeight);
+      BoxaPtr graphicBoxes;
+      if (not docStats->isBodyTextGraphical())
+        graphicBoxes.reset(getGraphicBoxes(doc.get(), onPage + 1, resolution));
+      std::vector<Caption> captions = buildCaptionsFromBoxes(
+          captionStarts.at(onPage), *docStats, pages.at(onPage),
+          graphicBoxes.get(), verbose);
+      for (Caption &caption : captions)
+        figures.push_back(Figure(caption, NULL));
+    } else if (not reused) {
+      fullRender = getFullRenderPix(doc.get(), onPage + 1, resolution);
+      pageWidth = fullRender->w;
+      pageHeight = fullRender->h;
+      PixPtr fullRender1d(pixConvertTo1(fullRender.get(), 250));
 
-    if (saveMistakes) {
-      for (Figure &fig : errors) {
-        figures.push_back(fig);
+      PixPtr graphics1d;
+      if (not docStats->isBodyTextGraphical()) {
+        PixPtr graphics = getGraphicOnlyPix(doc.get(), onPage + 1, resolution);
+        graphics1d.reset(pixConvertTo1(graphics.get(), 250));
+      } else {
+        graphics1d.reset(pixCreateTemplate(fullRender1d.get()));
       }
+
+      // Remove graphical elements that did not show up in the original due
+      // to PDF shenanigans.
+      pixAnd(graphics1d.get(), graphics1d.get(), fullRender1d.get());
+
+      std::vector<Caption> captions =
+          buildCaptions(captionStarts.at(onPage), *docStats, pages.at(onPage),
+                        graphics1d.get(), verbose);
+      PageRegions regions = getPageRegions(
+          fullRender1d.get(), pages.at(onPage), graphics1d.get(), captions,
+          *docStats, onPage, verbose, showSteps, errors, pageArena);
+      if (regions.captions.size() != 0) {
+        figures = extractFigures(fullRender1d.get(), regions, *docStats,
+                                 verbose, showSteps, errors);
+      }
+
+      if (figures.size() == 0 and verbose) {
+        printf("Warning: No figures recovered");
+      }
+
+      if (saveMistakes) {
+        for (Figure &fig : errors) {
+          figures.push_back(fig);
+        }
+      }
+
+      if (fingerprinter) {
+        std::ostringstream data;
+        data << pageWidth << " " << pageHeight << "\n";
+        writeFigures(figures, data);
+        cache->storePage(pageKey, data.str());
+      }
+    } else if (imagePrefix.length() != 0 or finalPrefix.length() != 0) {
+      fullRender = getFullRenderPix(doc.get(), onPage + 1, resolution);
     }
 
-    if (jsonPrefix.length() != 0) {
+    if (jsonPrefix.length() != 0 or binaryFile.length() != 0) {
       for (Figure &fig : figures) {
         allFigures.push_back(fig);
       }
-      pageSizes[onPage] = std::pair<int, int>(fullRender->w, fullRender->h);
+      pageSizes[onPage] = std::pair<int, int>(pageWidth, pageHeight);
     }
     if (imagePrefix.length() != 0) {
-      saveFiguresImage(figures, fullRender.get(), imagePrefix);
+      std::vector<std::string> written =
+          saveFiguresImage(figures, fullRender.get(), imagePrefix, imageFormat,
+                           thumbnails, writer);
+      if (cache) {
+        for (std::string &name : written)
+          cache->addOutput("figures", name);
+      }
     }
-    std::unique_ptr<PIX> fullColorRender;
+    PixPtr fullColorRender;
     if (colorImagePrefix.length() != 0) {
-      fullColorRender = getFullColorRenderPix(doc.get(), onPage + 1, resolution * resMultiply);
-      saveFiguresFullColorImage(figures, fullColorRender.get(), colorImagePrefix, resMultiply);
+      std::vector<std::string> written = std::vector<std::string>();
+      // Figures that are not a single embedded image are cropped from a
+      // render, which is skipped if there are none
+      std::vector<Figure> rendered = figures;
+      if (nativeImages) {
+        std::vector<NativeImage> natives;
+        getNativeImages(doc.get(), onPage + 1, resolution, figures,
+                        thumbnails.size() == 0, natives);
+        written = saveFiguresNativeImage(figures, natives, colorImagePrefix,
+                                         imageFormat, thumbnails, writer);
+        rendered.clear();
+        for (size_t i = 0; i < figures.size(); ++i) {
+          if (figures[i].imageBB != NULL and natives[i].jpeg.length() == 0 and
+              natives[i].pix == NULL)
+            rendered.push_back(figures[i]);
+        }
+        if (verbose)
+          printf("Saved %d native images\n", (int)written.size());
+      }
+      if (rendered.size() != 0) {
+        fullColorRender = getFullColorRenderPix(
+            doc.get(), onPage + 1, resolution * resMultiply);
+        std::vector<std::string> cropped = saveFiguresFullColorImage(
+            rendered, fullColorRender.get(), colorImagePrefix, resMultiply,
+            imageFormat, thumbnails, writer);
+        written.insert(written.end(), cropped.begin(), cropped.end());
+      }
+      if (cache) {
+        for (std::string &name : written)
+          cache->addOutput("color", name);
+      }
+    }
+    if (vectorPrefix.length() != 0) {
+      std::vector<std::string> written = saveFiguresVector(
+          doc.get(), onPage + 1, resolution, figures, vectorPrefix);
+      if (cache) {
+        for (std::string &name : written)
+          cache->addOutput("vector", name);
+      }
     }
     if (showFinal or finalPrefix.length() != 0) {
-      std::unique_ptr<PIX> final(drawFigureRegions(fullRender.get(), figures));
+      PixPtr final(drawFigureRegions(fullRender.get(), figures));
       if (showFinal)
         pixDisplay(final.get(), 0, 0);
-      if (finalPrefix.length() > 0)
-        pixWriteImpliedFormat(
-            (finalPrefix + "-" + std::to_string(onPage) + ".png").c_str(),
-            final.get(), 0, 0);
+      if (finalPrefix.length() > 0) {
+        std::string name = finalPrefix + "-" + std::to_string(onPage) + ".png";
+        writer.writeImage(name, final.release(), ImageFormat());
+        if (cache)
+          cache->addOutput("final", name);
+      }
     }
+    if (ndjsonFile.length() != 0) {
+      // Archive offsets are only known once the page's images are written
+      if (writer.isArchiving())
+        writer.wait();
+      for (Figure &fig : figures) {
+        recordBuilder.build(fig, pageWidth, pageHeight, record);
+        addArchivedImages(fig, record);
+        writeFigureRecordJSON(record, true, jsonBuffer, ndjson);
+        ndjson << "\n";
+      }
+      ndjson.flush();
+      ndjsonPages += 1;
+      ndjsonFigures += figures.size();
+    }
+    // Queued images are freed once they are written, they would be counted
+    // as memory this page kept
+    if (getProfiler().isTrackingMemory())
+      writer.wait();
     errors.clear();
     if (verbose)
       printf("Done\n\n");
   }
 
-  if (jsonPrefix.length() != 0) {
-    std::ofstream output((jsonPrefix + ".json").c_str());
-    output << "[\n";
-    for (size_t i = 0; i < allFigures.size(); ++i) {
-      Figure fig = allFigures[i];
-      int width, height;
-      if (fig.page != -1) {
-        width = pageSizes[fig.page].first;
-        height = pageSizes[fig.page].second;
-      } else {
-        width = -1;
-        height = -1;
-      }
-      writeFigureJSON(allFigures[i], width, height, resolution, pages, output);
-      if (i != allFigures.size() - 1) {
-        output << ",";
-      }
-      output << "\n";
+  PROFILE_PAGE(-1);
+  if (writer.isArchiving())
+    writer.wait();
+  std::vector<FigureRecord> records = std::vector<FigureRecord>();
+  for (Figure &fig : allFigures) {
+    int width = -1;
+    int height = -1;
+    if (fig.page != -1) {
+      width = pageSizes[fig.page].first;
+      height = pageSizes[fig.page].second;
     }
-    output << "]\n";
-    output.close();
+    recordBuilder.build(fig, width, height, record);
+    addArchivedImages(fig, record);
+    records.push_back(record);
+  }
+  if (jsonPrefix.length() != 0) {
+    std::ostringstream output;
+    writeFigureRecordsJSON(records, jsonBuffer, output);
+    writer.writeData(jsonPrefix + ".json", output.str());
     if (verbose) {
       printf("Saved %d figures to %s\n", (int)allFigures.size(),
              (jsonPrefix + ".json").c_str());
     }
+    if (cache)
+      cache->addOutput("json", jsonPrefix + ".json");
+  }
+  if (binaryFile.length() != 0) {
+    if (not appendFigureBinary(binaryFile, argv[optind], records)) {
+      printf("Could not append figures to %s\n", binaryFile.c_str());
+      return 1;
+    }
+    if (verbose)
+      printf("Appended %d figures to %s\n", (int)records.size(),
+             binaryFile.c_str());
+  }
+  finishNdjson();
+  if (not writer.finish()) {
+    for (const std::string &error : writer.getErrors())
+      printf("%s\n", error.c_str());
+    return 1;
+  }
+  if (verbose and getPixPool().isEnabled()) {
+    PixPool::Stats stats = getPixPool().getStats();
+    printf("Reused image buffers for %ld of %ld allocations\n", stats.hits,
+           stats.allocations);
   }
+  finishProfile();
+  if (cache)
+    cache->store();
   for (auto &textPage : pages) {
-    textPage->decRefCnt();
+    if (textPage != NULL)
+      textPage->decRefCnt();
   }
 }
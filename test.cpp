@@ -0,0 +1,395 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "FigureBinary.h"
+#include "FigureRecord.h"
+#include "TextUtils.h"
+
+namespace {
+
+// Words that exercise the matchers: the strings each pattern accepts, near
+// misses with extra or missing characters, punctuation and case changes,
+// Roman numerals and the empty string
+const std::vector<std::string> matcherInputs = {
+    "", " ", ".", ":", "Figure", "figure", "FIGURE", "Figure.", "Figure:",
+    "Figures", " Figure", "Figure ", "FIG", "FIG.", "Fig", "Fig.", "Fig:",
+    "Fig..", "fig.", "Table", "TABLE", "table", "Table.", "Tables", "Tab.",
+    "1", "12", "123", "1234", "0", "007", "1.", "1:", "1.:", "1:.", "1..",
+    "12.", "12:", "1.2", "1.23", "1.234", "1.2345", "12.5.", "123.4", "1,2",
+    ".5", "5.", "-1", "+1", "1a", "a1", "1 ", " 1", "1\n", "\n1", "I", "II",
+    "IV", "XII", "iv", "i.", "IV.", "IV:", "A", "A.", "S1", "1e5", "0x10",
+    "Medium", "Times-Bold", "Times-BoldItalic", "Helvetica-Oblique",
+    "CMSlant", "Itatlic", "Italic", "bold", "MEDI", "Med", "Bol",
+    "Times-Bold\n", "\nBold", "Bo\nld", "Slant\r", "ABCDEF+NimbusSanL-Bold"};
+
+int failures = 0;
+
+void check(bool ok, const char *matcher, const std::string &input) {
+  if (ok)
+    return;
+  printf("FAIL %s disagrees with std::regex on \"", matcher);
+  for (char c : input) {
+    if (c == '\n')
+      printf("\\n");
+    else if (c == '\r')
+      printf("\\r");
+    else
+      printf("%c", c);
+  }
+  printf("\"\n");
+  failures += 1;
+}
+
+// The hand-written matchers in TextUtils replaced these std::regex patterns,
+// each must accept exactly the same words
+void testMatchers() {
+  const std::regex captionWord =
+      std::regex("^(Figure|(FIG)|(Fig\\.)||Fig|Table)$");
+  const std::regex captionNumber = std::regex("^([0-9]+)(:|\\.)?$");
+  const std::regex decimal = std::regex("^[0-9]+(\\.[0-9]+)?$");
+  const std::regex pageNumber = std::regex("^[0-9]{1,3}$");
+  const std::regex titleNumber =
+      std::regex("^[0-9]{1,2}(\\.[0-9]{1,3})?\\.?$");
+  const std::regex boldFont = std::regex(".*(Medi|Bold).*");
+  const std::regex italicFont = std::regex(".*(Slant|Itatlic).*");
+
+  for (const std::string &input : matcherInputs) {
+    const char *text = input.c_str();
+    std::cmatch match;
+
+    // The pattern's empty alternative matched empty words, which then failed
+    // when their first character was read. Empty words are not captions now.
+    bool caps, abbreviated;
+    bool matched = matchCaptionWord(text, &caps, &abbreviated);
+    bool expected = std::regex_match(text, match, captionWord);
+    check(matched == (expected and input.length() != 0), "matchCaptionWord",
+          input);
+    if (matched) {
+      check(caps == match[2].matched and abbreviated == match[3].matched,
+            "matchCaptionWord groups", input);
+    }
+
+    int numberLength;
+    matched = matchCaptionNumber(text, &numberLength);
+    check(matched == std::regex_match(text, match, captionNumber),
+          "matchCaptionNumber", input);
+    if (matched) {
+      check(numberLength == match[1].length(), "matchCaptionNumber length",
+            input);
+    }
+
+    check(matchDecimal(text) == std::regex_match(text, decimal),
+          "matchDecimal", input);
+    check(matchPageNumber(text) == std::regex_match(text, pageNumber),
+          "matchPageNumber", input);
+    check(matchTitleNumber(text) == std::regex_match(text, titleNumber),
+          "matchTitleNumber", input);
+    check(fontNameIsBold(text) == std::regex_match(text, boldFont),
+          "fontNameIsBold", input);
+    check(fontNameIsItalic(text) == std::regex_match(text, italicFont),
+          "fontNameIsItalic", input);
+  }
+}
+
+std::string readFile(const std::string &name) {
+  std::ifstream input(name.c_str(), std::ios::binary);
+  std::ostringstream contents;
+  contents << input.rdbuf();
+  return contents.str();
+}
+
+// Writes a PDF with a US letter page for each of contents, the content
+// streams can use Helvetica as /F1
+void writePDF(const std::string &name,
+              const std::vector<std::string> &contents) {
+  std::string pdf = "%PDF-1.4\n";
+  std::vector<size_t> offsets = std::vector<size_t>();
+  auto addObject = [&](const std::string &object) {
+    offsets.push_back(pdf.size());
+    pdf += std::to_string(offsets.size()) + " 0 obj\n" + object +
+           "\nendobj\n";
+  };
+  std::string kids = "";
+  for (size_t i = 0; i < contents.size(); ++i)
+    kids += std::to_string(4 + 2 * i) + " 0 R ";
+  addObject("<< /Type /Catalog /Pages 2 0 R >>");
+  addObject("<< /Type /Pages /Kids [" + kids +
+            "] /Count " + std::to_string(contents.size()) + " >>");
+  addObject("<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>");
+  for (size_t i = 0; i < contents.size(); ++i) {
+    addObject("<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] "
+              "/Resources << /Font << /F1 3 0 R >> >> /Contents " +
+              std::to_string(5 + 2 * i) + " 0 R >>");
+    addObject("<< /Length " + std::to_string(contents[i].size()) +
+              " >>\nstream\n" + contents[i] + "\nendstream");
+  }
+  size_t xref = pdf.size();
+  pdf += "xref\n0 " + std::to_string(offsets.size() + 1) +
+         "\n0000000000 65535 f \n";
+  for (size_t offset : offsets) {
+    char entry[21];
+    snprintf(entry, sizeof(entry), "%010lu 00000 n \n",
+             (unsigned long)offset);
+    pdf += entry;
+  }
+  pdf += "trailer\n<< /Size " + std::to_string(offsets.size() + 1) +
+         " /Root 1 0 R >>\nstartxref\n" + std::to_string(xref) +
+         "\n%%EOF\n";
+  std::ofstream output(name.c_str(), std::ios::binary);
+  output << pdf;
+}
+
+// Content stream drawing lines of body text starting at y
+std::string bodyText(int y, int lines) {
+  std::string text = "BT /F1 10 Tf 12 TL 72 " + std::to_string(y) + " Td\n";
+  for (int i = 0; i < lines; ++i) {
+    text += "(Line " + std::to_string(i) +
+            " of the body text that fills this page from margin to "
+            "margin.) Tj T*\n";
+  }
+  return text + "ET\n";
+}
+
+// Content stream of a page with body text, a gray box and its caption
+std::string figurePage() {
+  return bodyText(720, 14) + "0.5 g 150 400 300 140 re f 0 g\n" +
+         "BT /F1 10 Tf 72 380 Td (Figure 1: A gray box drawn for the "
+         "test.) Tj ET\n" +
+         bodyText(340, 20);
+}
+
+// Runs pdffigures from the current directory, its output goes to log
+int runPdffigures(const std::string &args, const std::string &log) {
+  return std::system(("./pdffigures " + args + " > " + log + " 2>&1").c_str());
+}
+
+// Caches the pages of a document, inserts a page in front of the page with
+// the figure, and checks that the cached results of the moved page are
+// reused with their new page number
+void testPageCacheAfterInsert() {
+  char dirTemplate[] = "/tmp/pdffigures-test-XXXXXX";
+  if (mkdtemp(dirTemplate) == NULL) {
+    printf("FAIL could not create a temporary directory\n");
+    failures += 1;
+    return;
+  }
+  std::string dir = dirTemplate;
+  std::vector<std::string> pages = std::vector<std::string>();
+  pages.push_back(bodyText(720, 50));
+  pages.push_back(figurePage());
+  writePDF(dir + "/v1.pdf", pages);
+  pages.insert(pages.begin() + 1, bodyText(700, 48));
+  writePDF(dir + "/v2.pdf", pages);
+
+  std::string cached = "-m -v --cache " + dir + "/cache --incremental ";
+  int status = runPdffigures(cached + "-j " + dir + "/v1 " + dir + "/v1.pdf",
+                             dir + "/v1.log");
+  status |= runPdffigures(cached + "-j " + dir + "/v2 " + dir + "/v2.pdf",
+                          dir + "/v2.log");
+  status |= runPdffigures("-m -j " + dir + "/full " + dir + "/v2.pdf",
+                          dir + "/full.log");
+  std::string full = readFile(dir + "/full.json");
+  if (status != 0) {
+    printf("FAIL pdffigures failed, see the logs in %s\n", dir.c_str());
+    failures += 1;
+  } else if (full.find("\"Page\": 3") == std::string::npos) {
+    printf("FAIL no figure found on page 3 of %s/v2.pdf\n", dir.c_str());
+    failures += 1;
+  } else if (readFile(dir + "/v2.log").find("Reusing cached results") ==
+             std::string::npos) {
+    printf("FAIL the cached page was not reused, see %s/v2.log\n",
+           dir.c_str());
+    failures += 1;
+  } else if (readFile(dir + "/v2.json") != full) {
+    printf("FAIL %s/v2.json from the cache differs from %s/full.json\n",
+           dir.c_str(), dir.c_str());
+    failures += 1;
+  } else {
+    std::system(("rm -rf " + dir).c_str());
+  }
+}
+
+// Records with and without captions, images and words, the strings use
+// lengths that are not multiples of 8 so the padding is exercised
+std::vector<FigureRecord> makeRecords(int page, int nFigures) {
+  std::vector<FigureRecord> records = std::vector<FigureRecord>();
+  for (int i = 0; i < nFigures; ++i) {
+    FigureRecord record = FigureRecord();
+    record.type = i % 2 == 0 ? "Figure" : "Table";
+    record.number = i + 1;
+    record.page = page;
+    record.dpi = 100;
+    record.width = 612 + i;
+    record.height = 792;
+    record.hasCaption = i != 2;
+    record.hasImage = i != 1;
+    for (int j = 0; j < 4; ++j) {
+      record.captionBB[j] = record.hasCaption ? 10 * j + i : 0;
+      record.imageBB[j] = record.hasImage ? 20 * j - i : 0;
+    }
+    if (record.hasCaption)
+      record.caption = record.type + " " + std::to_string(i + 1) +
+                       ": Caption with \"quotes\" and caf\xc3\xa9.";
+    for (int j = 0; record.hasImage and j < i + 1; ++j) {
+      WordRecord word;
+      word.rotation = j % 4;
+      for (int k = 0; k < 4; ++k)
+        word.bb[k] = 1.5 * k + j;
+      word.text = std::string(j + 1, 'a' + j);
+      record.imageText.push_back(word);
+    }
+    records.push_back(record);
+  }
+  return records;
+}
+
+std::string toJSON(const std::vector<FigureRecord> &records) {
+  std::ostringstream output;
+  std::string buffer = "";
+  writeFigureRecordsJSON(records, buffer, output);
+  return output.str();
+}
+
+// Checks that the documents in the file at path read back as names and
+// documents
+void checkFigureBinary(const std::string &path,
+                       const std::vector<std::string> &names,
+                       const std::vector<std::vector<FigureRecord>> &documents,
+                       const char *what) {
+  FigureBinaryReader reader(path);
+  if (not reader.isOk() or reader.getNumDocuments() != (int)names.size()) {
+    printf("FAIL %s: %s does not have %d documents\n", what, path.c_str(),
+           (int)names.size());
+    failures += 1;
+    return;
+  }
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::vector<FigureRecord> records = std::vector<FigureRecord>();
+    if (reader.getDocumentName(i) != names[i] or
+        reader.getNumFigures(i) != (int)documents[i].size() or
+        not reader.readFigures(i, records) or
+        toJSON(records) != toJSON(documents[i])) {
+      printf("FAIL %s: document %d of %s differs from what was written\n",
+             what, (int)i, path.c_str());
+      failures += 1;
+    }
+  }
+}
+
+// Appends documents to a binary figure file, reads them back directly and
+// through pdffigures-bin2json, then cuts the trailer off and checks that the
+// index is rebuilt from the document blocks
+void testFigureBinaryRoundTrip() {
+  char dirTemplate[] = "/tmp/pdffigures-test-XXXXXX";
+  if (mkdtemp(dirTemplate) == NULL) {
+    printf("FAIL could not create a temporary directory\n");
+    failures += 1;
+    return;
+  }
+  std::string dir = dirTemplate;
+  int failed = failures;
+  std::string path = dir + "/figures.bin";
+  std::vector<std::string> names = {"first.pdf", "second document.pdf"};
+  std::vector<std::vector<FigureRecord>> documents = {makeRecords(3, 3),
+                                                      makeRecords(1, 0)};
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (not appendFigureBinary(path, names[i], documents[i])) {
+      printf("FAIL could not append to %s\n", path.c_str());
+      failures += 1;
+      return;
+    }
+  }
+  checkFigureBinary(path, names, documents, "round trip");
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    std::string json = dir + "/" + std::to_string(i) + ".json";
+    int status = std::system(("./pdffigures-bin2json " + path + " " +
+                              std::to_string(i) + " > " + json)
+                                 .c_str());
+    if (status != 0 or readFile(json) != toJSON(documents[i])) {
+      printf("FAIL pdffigures-bin2json output differs, see %s\n",
+             json.c_str());
+      failures += 1;
+    }
+  }
+
+  // As if a writer died while writing the trailer
+  std::string truncated = dir + "/truncated.bin";
+  std::string contents = readFile(path);
+  {
+    std::ofstream output(truncated.c_str(), std::ios::binary);
+    output << contents.substr(0, contents.size() - 5);
+  }
+  checkFigureBinary(truncated, names, documents, "rebuilt index");
+  names.push_back("third.pdf");
+  documents.push_back(makeRecords(7, 2));
+  if (not appendFigureBinary(truncated, names.back(), documents.back())) {
+    printf("FAIL could not append to %s\n", truncated.c_str());
+    failures += 1;
+  } else {
+    checkFigureBinary(truncated, names, documents, "append after rebuild");
+  }
+
+  if (failures == failed)
+    std::system(("rm -rf " + dir).c_str());
+}
+
+#ifdef PROFILE
+// Runs the page stages under --memory-report and checks that no page keeps
+// PIX memory allocated once it is done
+void testPagesKeepNoPixMemory() {
+  char dirTemplate[] = "/tmp/pdffigures-test-XXXXXX";
+  if (mkdtemp(dirTemplate) == NULL) {
+    printf("FAIL could not create a temporary directory\n");
+    failures += 1;
+    return;
+  }
+  std::string dir = dirTemplate;
+  std::vector<std::string> pages = std::vector<std::string>();
+  pages.push_back(bodyText(720, 50));
+  pages.push_back(figurePage());
+  pages.push_back(figurePage());
+  writePDF(dir + "/doc.pdf", pages);
+
+  int status = runPdffigures("-m --memory-report " + dir + "/memory.json " +
+                                 dir + "/doc.pdf",
+                             dir + "/doc.log");
+  std::string report = readFile(dir + "/memory.json");
+  if (status != 0) {
+    printf("FAIL pdffigures failed, see %s/doc.log\n", dir.c_str());
+    failures += 1;
+  } else if (report.find("\"Page\": 3") == std::string::npos) {
+    printf("FAIL the pages are missing from %s/memory.json\n", dir.c_str());
+    failures += 1;
+  } else if (report.find("\"GrowingPages\": []") == std::string::npos) {
+    printf("FAIL pages kept PIX memory, see %s/memory.json\n", dir.c_str());
+    failures += 1;
+  } else {
+    std::system(("rm -rf " + dir).c_str());
+  }
+}
+#endif
+
+} // end namespace
+
+int main(int argc, char **argv) {
+  testMatchers();
+  testPageCacheAfterInsert();
+  testFigureBinaryRoundTrip();
+#ifdef PROFILE
+  testPagesKeepNoPixMemory();
+#endif
+  if (failures != 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All tests passed\n");
+  return 0;
+}